@@ -18,6 +18,8 @@ libs=(
     -lz
     -lpng
     -ljpeg
+    -lpthread
+    -lm
 )
 
 if echo "$OSTYPE" | grep -q "darwin"; then
@@ -23,12 +23,16 @@ OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
 OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
 SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <imgtool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <pthread.h>
 
 #define BUFF_SIZE 1024
+#define KERNEL_SIZE 15
 
 typedef enum {
     IMG_COMMAND_NULL,
@@ -47,28 +51,151 @@ typedef enum {
     IMG_COMMAND_FRAME_DUMP,
     IMG_COMMAND_RESIZE_WIDTH,
     IMG_COMMAND_RESIZE_HEIGHT,
-    IMG_COMMAND_RESIZE_F
+    IMG_COMMAND_RESIZE_F,
+    IMG_COMMAND_CROP,
+    IMG_COMMAND_ROTATE_180,
+    IMG_COMMAND_RESIZE,
+    IMG_COMMAND_MIPS,
+    IMG_COMMAND_ROTATE_270,
+    IMG_COMMAND_TRANSPOSE,
+    IMG_COMMAND_ROTATE_ANGLE,
+    IMG_COMMAND_WARP,
+    IMG_COMMAND_BLUR,
+    IMG_COMMAND_CONVOLVE
 } imgtool_command_enum;
 
+/* an image decoded only in part for the leading geometric run keeps its full
+ * size, the full image position of the bitmap and the scale it was decoded
+ * at; source_width is zero once the bitmap is the whole image */
+typedef struct {
+    bmp_t bitmap;
+    uint8_t* buffer;
+    bmp_t* scratch;
+    unsigned int source_x, source_y, source_width, source_height, source_denom;
+} imgtool_frame_t;
+
+typedef struct {
+    const unsigned int* commands;
+    const px_op_t* pointwise;
+    const unsigned int* fused;
+    const unsigned int* geometry;
+    unsigned int count;
+} imgtool_program_t;
+
+/* a run of geometric commands folded into a source rect and then a transpose,
+ * a horizontal and a vertical flip; the loader also solves the run up to its
+ * first scaling command, which resamples to width x height with filter */
+typedef struct {
+    unsigned int x, y, src_width, src_height;
+    unsigned int width, height;
+    unsigned int transpose, flip_h, flip_v;
+    img_filter_enum filter;
+} imgtool_geometry_t;
+
+typedef struct {
+    unsigned int head, tail;
+    pthread_mutex_t lock;
+} imgtool_deque_t;
+
+typedef struct {
+    char (*input_path)[BUFF_SIZE];
+    const char* output_path;
+    unsigned int* numbers;
+    unsigned char* decoded;
+    const imgtool_program_t* program;
+    imgtool_deque_t* deques;
+    unsigned int input_count, output_count, output_to_input;
+    unsigned int workers, loaded, processed, resolved, numbered;
+    unsigned int max_frames, frames, parked;
+    size_t max_bytes, bytes;
+    pthread_mutex_t lock;
+    pthread_cond_t room;
+} imgtool_batch_t;
+
+typedef struct {
+    imgtool_batch_t* batch;
+    unsigned int id;
+} imgtool_worker_t;
+
+typedef struct {
+    unsigned int index;
+    size_t size;
+    imgtool_frame_t frame;
+} imgtool_item_t;
+
+#define IMGTOOL_QUEUE_SIZE 2
+
+typedef struct {
+    imgtool_item_t items[IMGTOOL_QUEUE_SIZE];
+    unsigned int head, count, closed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready, room;
+} imgtool_queue_t;
+
+typedef struct {
+    imgtool_batch_t* batch;
+    imgtool_queue_t* queue;
+} imgtool_stage_t;
+
+typedef struct {
+    char path[BUFF_SIZE];
+    const bmp_t* bitmap;
+    pthread_t thread;
+    int started;
+} imgtool_level_t;
+
 static unsigned int jcompress_quality = 100;
 static unsigned int sensibility = 255;
 static unsigned int resize_x, resize_y;
 static float resize_scale;
+static unsigned int resize_width, resize_height;
+static img_filter_enum resize_filter = IMG_FILTER_LANCZOS3;
+static float rotate_degrees, warp_matrix[9];
+static img_filter_enum warp_filter = IMG_FILTER_CATMULL_ROM;
+static img_border_enum warp_border = IMG_BORDER_ZERO;
+static unsigned int crop_x, crop_y, crop_width, crop_height;
+static float blur_radius;
+static int blur_box;
+static int convolve_kernel[KERNEL_SIZE * KERNEL_SIZE], convolve_divisor, convolve_bias, convolve_preset = -1;
+static unsigned int convolve_width, convolve_height;
+static char mips_path[BUFF_SIZE];
+
+#define bmp_swap(func, frame)               \
+do {                                        \
+    bmp_t b = func(&(frame)->bitmap);       \
+    free((frame)->buffer);                  \
+    (frame)->buffer = b.pixels;             \
+    memcpy(&(frame)->bitmap, &b, sizeof(bmp_t)); \
+} while (0)
+
+#define bmp_swap_param(func, frame, val)    \
+do {                                        \
+    bmp_t b = func(&(frame)->bitmap, val);  \
+    free((frame)->buffer);                  \
+    (frame)->buffer = b.pixels;             \
+    memcpy(&(frame)->bitmap, &b, sizeof(bmp_t)); \
+} while (0)
 
-#define bmp_swap(func, bmp)                 \
+#define bmp_pingpong(func, frame)           \
 do {                                        \
-    bmp_t b = func(bmp);                    \
-    bmp_free(bmp);                          \
-    memcpy(bmp, &b, sizeof(bmp_t));         \
+    func##_into(&(frame)->bitmap, (frame)->scratch); \
+    imgtool_frame_flip(frame);              \
 } while (0)
 
-#define bmp_swap_param(func, bmp, val)      \
+#define bmp_pingpong_param(func, frame, val) \
 do {                                        \
-    bmp_t b = func(bmp, val);               \
-    bmp_free(bmp);                          \
-    memcpy(bmp, &b, sizeof(bmp_t));         \
+    func##_into(&(frame)->bitmap, (frame)->scratch, val); \
+    imgtool_frame_flip(frame);              \
 } while (0)
 
+static void imgtool_frame_flip(imgtool_frame_t* frame)
+{
+    uint8_t* buffer = frame->buffer;
+    frame->buffer = frame->scratch->pixels;
+    memcpy(&frame->bitmap, frame->scratch, sizeof(bmp_t));
+    frame->scratch->pixels = buffer;
+}
+
 static void imgtool_open_at_exit(int check, const char* path)
 {
     if (!check) return;
@@ -82,47 +209,426 @@ static void imgtool_open_at_exit(int check, const char* path)
     system(open_str);
 }                           
 
-static void imgtool_command(unsigned int command, bmp_t* bitmap)
+static void imgtool_crop(bmp_t* bitmap)
 {
+    const unsigned int x = crop_x < bitmap->width ? crop_x : bitmap->width - 1;
+    const unsigned int y = crop_y < bitmap->height ? crop_y : bitmap->height - 1;
+    const unsigned int width = crop_width && crop_width <= bitmap->width - x ? crop_width : bitmap->width - x;
+    const unsigned int height = crop_height && crop_height <= bitmap->height - y ? crop_height : bitmap->height - y;
+    bmp_t view = bmp_view(bitmap, x, y, width, height);
+    memcpy(bitmap, &view, sizeof(bmp_t));
+}
+
+/* a zero width or height keeps the aspect ratio of the frame */
+static void imgtool_resize(imgtool_frame_t* frame)
+{
+    const bmp_t* bitmap = &frame->bitmap;
+    unsigned int width = resize_width, height = resize_height;
+    if (!width && !height) return;
+    if (!width) width = (unsigned int)((unsigned long)bitmap->width * height / bitmap->height);
+    if (!height) height = (unsigned int)((unsigned long)bitmap->height * width / bitmap->width);
+    bmp_resize_into(bitmap, frame->scratch, width ? width : 1, height ? height : 1, resize_filter);
+    imgtool_frame_flip(frame);
+}
+
+static img_filter_enum imgtool_parse_filter(const char* name)
+{
+    if (!strcmp(name, "box")) return IMG_FILTER_BOX;
+    if (!strcmp(name, "triangle") || !strcmp(name, "linear")) return IMG_FILTER_TRIANGLE;
+    if (!strcmp(name, "catmull-rom") || !strcmp(name, "cubic")) return IMG_FILTER_CATMULL_ROM;
+    if (!strcmp(name, "area")) return IMG_FILTER_AREA;
+    if (strcmp(name, "lanczos3") && strcmp(name, "lanczos")) {
+        fprintf(stderr, "imgtool does not know filter '%s', using lanczos3\n", name);
+    }
+    return IMG_FILTER_LANCZOS3;
+}
+
+/* turns clockwise about the center of the frame, quarter turns stay exact */
+static void imgtool_rotate_angle(imgtool_frame_t* frame)
+{
+    const double angle = rotate_degrees * 3.14159265358979323846 / 180.0;
+    double c = cos(angle), s = sin(angle);
+    if (fabs(c) < 1e-9) c = 0.0;
+    if (fabs(s) < 1e-9) s = 0.0;
+    const double cx = frame->bitmap.width * 0.5, cy = frame->bitmap.height * 0.5;
+    const float matrix[9] = {
+        (float)c, (float)-s, (float)(cx - c * cx + s * cy),
+        (float)s, (float)c, (float)(cy - s * cx - c * cy),
+        0.0F, 0.0F, 1.0F
+    };
+    bmp_warp_into(&frame->bitmap, frame->scratch, matrix, warp_filter, warp_border);
+    imgtool_frame_flip(frame);
+}
+
+/* reads a matrix as a,b,c,d,e,f for affine or nine values, with an optional :filter */
+static void imgtool_parse_warp(const char* str)
+{
+    float* m = warp_matrix;
+    const int n = sscanf(str, "%f,%f,%f,%f,%f,%f,%f,%f,%f", m, m + 1, m + 2, m + 3, m + 4, m + 5, m + 6, m + 7, m + 8);
+    if (n == 6 || n == 9) {
+        if (n == 6) m[6] = m[7] = 0.0F, m[8] = 1.0F;
+    } else {
+        fprintf(stderr, "imgtool needs 6 or 9 values to warp, got '%s'\n", str);
+        memset(m, 0, 9 * sizeof(float));
+        m[0] = m[4] = m[8] = 1.0F;
+    }
+    const char* filter = strchr(str, ':');
+    if (filter) warp_filter = imgtool_parse_filter(filter + 1);
+}
+
+/* reads a preset name or WxH:k,k,...[/divisor][+bias] */
+static void imgtool_parse_kernel(const char* str)
+{
+    static const char* presets[] = {"sharpen", "edge", "emboss", "unsharp"};
+    for (unsigned int i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (!strcmp(str, presets[i])) {
+            convolve_preset = (int)i;
+            return;
+        }
+    }
+
+    int n = 0, ok = 0;
+    convolve_preset = -1;
+    convolve_divisor = convolve_bias = 0;
+    if (sscanf(str, "%ux%u:%n", &convolve_width, &convolve_height, &n) == 2 && n &&
+        convolve_width && convolve_height && convolve_width <= KERNEL_SIZE && convolve_height <= KERNEL_SIZE) {
+        const char* p = str + n;
+        char* next;
+        unsigned int count = 0;
+        for (; count < convolve_width * convolve_height; count++, p = next + (*next == ',')) {
+            convolve_kernel[count] = (int)strtol(p, &next, 10);
+            if (next == p) break;
+        }
+        if (*next == '/') convolve_divisor = (int)strtol(next + 1, &next, 10);
+        if (*next == '+' || *next == '-') convolve_bias = (int)strtol(next, &next, 10);
+        ok = count == convolve_width * convolve_height && !*next;
+    }
+    if (!ok) {
+        fprintf(stderr, "imgtool could not read kernel '%s', expected a preset or WxH:k,k,... up to %dx%d\n", str, KERNEL_SIZE, KERNEL_SIZE);
+        convolve_width = convolve_height = 1;
+        convolve_kernel[0] = 1;
+        convolve_divisor = convolve_bias = 0;
+    }
+}
+
+static void imgtool_parse_png(const char* str)
+{
+    static const char* filters[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+    static const char* strategies[] = {"auto", "default", "filtered", "huffman", "rle"};
+    img_png_options_t options = img_get_png_options();
+    char buf[BUFF_SIZE];
+    strncpy(buf, str, BUFF_SIZE - 1);
+    buf[BUFF_SIZE - 1] = 0;
+    for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        int found = 0;
+        if (tok[0] >= '0' && tok[0] <= '9' && !tok[1]) {
+            options.level = tok[0] - '0';
+            found = 1;
+        }
+        for (unsigned int i = 0; i < sizeof(filters) / sizeof(filters[0]) && !found; i++) {
+            if (!strcmp(tok, filters[i])) options.filter = (img_png_filter_enum)i, found = 1;
+        }
+        for (unsigned int i = 0; i < sizeof(strategies) / sizeof(strategies[0]) && !found; i++) {
+            if (!strcmp(tok, strategies[i])) options.strategy = (img_png_strategy_enum)i, found = 1;
+        }
+        if (!strcmp(tok, "fast")) options.fast = found = 1;
+        else if (!strcmp(tok, "parallel")) options.parallel = found = 1;
+        else if (!strcmp(tok, "rgba")) options.rgba = found = 1;
+        if (!found) fprintf(stderr, "imgtool does not know PNG option '%s'\n", tok);
+    }
+    img_set_png_options(&options);
+}
+
+static int imgtool_pointwise(unsigned int command, px_op_t* op)
+{
+    op->param = 0;
     switch (command) {
+        case IMG_COMMAND_NEGATIVE: {
+            op->op = IMG_PX_NEGATIVE;
+            return 1;
+        }
         case IMG_COMMAND_BLACK_AND_WHITE: {
-            bmp_swap(bmp_black_and_white, bitmap);
+            op->op = IMG_PX_BLACK_AND_WHITE;
+            return 1;
+        }
+        case IMG_COMMAND_WHITE_TO_TRANSPARENT: {
+            op->op = IMG_PX_WHITE_TO_TRANSPARENT;
+            return 1;
+        }
+        case IMG_COMMAND_WHITE_SENSIBILITY: {
+            op->op = IMG_PX_CLEAR_TO_TRANSPARENT;
+            op->param = (uint8_t)sensibility;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void imgtool_pointwise_chain(imgtool_frame_t* frame, const px_op_t* ops, const unsigned int count)
+{
+    if (px_op_channels(frame->bitmap.channels, ops, count) == frame->bitmap.channels) {
+        bmp_pointwise_inplace(&frame->bitmap, ops, count);
+    } else {
+        bmp_pointwise_into(&frame->bitmap, frame->scratch, ops, count);
+        imgtool_frame_flip(frame);
+    }
+}
+
+static int imgtool_is_geometry(unsigned int command)
+{
+    switch (command) {
+        case IMG_COMMAND_FLIP_HORIZONTAL:
+        case IMG_COMMAND_FLIP_VERTICAL:
+        case IMG_COMMAND_ROTATE:
+        case IMG_COMMAND_ROTATE_180:
+        case IMG_COMMAND_ROTATE_270:
+        case IMG_COMMAND_TRANSPOSE:
+        case IMG_COMMAND_CROP:
+        case IMG_COMMAND_SCALE_UP:
+        case IMG_COMMAND_SCALE_DOWN:
+        case IMG_COMMAND_RESIZE_WIDTH:
+        case IMG_COMMAND_RESIZE_HEIGHT:
+        case IMG_COMMAND_RESIZE_F:
+        case IMG_COMMAND_RESIZE: return 1;
+    }
+    return 0;
+}
+
+static int imgtool_is_scale(unsigned int command)
+{
+    switch (command) {
+        case IMG_COMMAND_SCALE_UP:
+        case IMG_COMMAND_SCALE_DOWN:
+        case IMG_COMMAND_RESIZE_WIDTH:
+        case IMG_COMMAND_RESIZE_HEIGHT:
+        case IMG_COMMAND_RESIZE_F: return 1;
+        case IMG_COMMAND_RESIZE: return resize_width || resize_height;
+    }
+    return 0;
+}
+
+/* maps a rect of the oriented frame back to the source rect, the run has not scaled yet */
+static void imgtool_geometry_crop(imgtool_geometry_t* g, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    const unsigned int frame_width = g->transpose ? g->height : g->width;
+    const unsigned int frame_height = g->transpose ? g->width : g->height;
+    if (g->flip_h) x = frame_width - x - width;
+    if (g->flip_v) y = frame_height - y - height;
+    if (g->transpose) {
+        unsigned int t = x; x = y; y = t;
+        t = width; width = height; height = t;
+    }
+    g->x += x;
+    g->y += y;
+    g->src_width = g->width = width;
+    g->src_height = g->height = height;
+}
+
+static void imgtool_geometry_add(imgtool_geometry_t* g, unsigned int command)
+{
+    const unsigned int frame_width = g->transpose ? g->height : g->width;
+    const unsigned int frame_height = g->transpose ? g->width : g->height;
+    unsigned int width = frame_width, height = frame_height, t;
+    switch (command) {
+        case IMG_COMMAND_FLIP_HORIZONTAL: g->flip_h ^= 1; return;
+        case IMG_COMMAND_FLIP_VERTICAL: g->flip_v ^= 1; return;
+        case IMG_COMMAND_ROTATE_180: g->flip_h ^= 1, g->flip_v ^= 1; return;
+        case IMG_COMMAND_CROP: {
+            const unsigned int x = crop_x < frame_width ? crop_x : frame_width - 1;
+            const unsigned int y = crop_y < frame_height ? crop_y : frame_height - 1;
+            width = crop_width && crop_width <= frame_width - x ? crop_width : frame_width - x;
+            height = crop_height && crop_height <= frame_height - y ? crop_height : frame_height - y;
+            imgtool_geometry_crop(g, x, y, width, height);
+            return;
+        }
+        /* a flip before a transpose is the other flip after it */
+        case IMG_COMMAND_TRANSPOSE:
+        case IMG_COMMAND_ROTATE:
+        case IMG_COMMAND_ROTATE_270: {
+            t = g->flip_h, g->flip_h = g->flip_v, g->flip_v = t;
+            g->transpose ^= 1;
+            if (command == IMG_COMMAND_ROTATE) g->flip_h ^= 1;
+            if (command == IMG_COMMAND_ROTATE_270) g->flip_v ^= 1;
+            return;
+        }
+        case IMG_COMMAND_SCALE_UP: {
+            width *= 2, height *= 2;
+            g->filter = IMG_FILTER_BOX;
             break;
         }
-        case IMG_COMMAND_NEGATIVE: {
-            bmp_swap(bmp_negative, bitmap);
+        case IMG_COMMAND_SCALE_DOWN: {
+            width /= 2, height /= 2;
+            g->filter = IMG_FILTER_BOX;
+            break;
+        }
+        case IMG_COMMAND_RESIZE_WIDTH: {
+            width = resize_x;
+            g->filter = IMG_FILTER_TRIANGLE;
+            break;
+        }
+        case IMG_COMMAND_RESIZE_HEIGHT: {
+            height = resize_y;
+            g->filter = IMG_FILTER_TRIANGLE;
+            break;
+        }
+        case IMG_COMMAND_RESIZE_F: {
+            width = (unsigned int)((float)width * resize_scale);
+            height = (unsigned int)((float)height * resize_scale);
+            g->filter = IMG_FILTER_TRIANGLE;
             break;
         }
+        case IMG_COMMAND_RESIZE: {
+            if (!resize_width && !resize_height) return;
+            width = resize_width ? resize_width : (unsigned int)((unsigned long)frame_width * resize_height / frame_height);
+            height = resize_height ? resize_height : (unsigned int)((unsigned long)frame_height * resize_width / frame_width);
+            g->filter = resize_filter;
+            break;
+        }
+    }
+    g->width = g->transpose ? height : width;
+    g->height = g->transpose ? width : height;
+    if (!g->width) g->width = 1;
+    if (!g->height) g->height = 1;
+}
+
+/* the first segment of a run ends with its first scaling command */
+static unsigned int imgtool_geometry_segment(const unsigned int* commands, const unsigned int count)
+{
+    unsigned int i = 0;
+    while (i < count && !imgtool_is_scale(commands[i])) {
+        i++;
+    }
+    return i < count ? i + 1 : count;
+}
+
+/* solves the first segment of a run for the loader */
+static void imgtool_geometry_solve(imgtool_geometry_t* g, const unsigned int width, const unsigned int height, const unsigned int* commands, const unsigned int count)
+{
+    memset(g, 0, sizeof(imgtool_geometry_t));
+    g->src_width = g->width = width;
+    g->src_height = g->height = height;
+    g->filter = IMG_FILTER_BOX;
+    for (unsigned int i = 0; i < imgtool_geometry_segment(commands, count); i++) {
+        imgtool_geometry_add(g, commands[i]);
+    }
+}
+
+/* takes the source rect as a view, of the decoded part when the loader left one */
+static void imgtool_geometry_view(imgtool_frame_t* frame, imgtool_geometry_t* g)
+{
+    const unsigned int x = frame->source_width ? g->x - frame->source_x : g->x;
+    const unsigned int y = frame->source_width ? g->y - frame->source_y : g->y;
+    bmp_t view = bmp_view(&frame->bitmap, x, y, g->src_width, g->src_height);
+    memcpy(&frame->bitmap, &view, sizeof(bmp_t));
+    frame->source_width = frame->source_height = 0;
+    g->x = g->y = 0;
+    g->src_width = g->width = frame->bitmap.width;
+    g->src_height = g->height = frame->bitmap.height;
+}
+
+static void imgtool_geometry_orient(imgtool_frame_t* frame, imgtool_geometry_t* g)
+{
+    if (!g->transpose) {
+        if (g->flip_h && g->flip_v) bmp_rotate_180_inplace(&frame->bitmap);
+        else if (g->flip_h) bmp_flip_horizontal_inplace(&frame->bitmap);
+        else if (g->flip_v) bmp_flip_vertical_inplace(&frame->bitmap);
+    }
+    else if (g->flip_h && g->flip_v) bmp_pingpong(bmp_transverse, frame);
+    else if (g->flip_h) bmp_pingpong(bmp_rotate, frame);
+    else if (g->flip_v) bmp_pingpong(bmp_rotate_270, frame);
+    else bmp_pingpong(bmp_transpose, frame);
+    g->transpose = g->flip_h = g->flip_v = 0;
+    g->width = g->src_width = frame->bitmap.width;
+    g->height = g->src_height = frame->bitmap.height;
+}
+
+/* a frame the loader decoded at a reduced scale takes the first segment's
+ * source rect moved and scaled onto it, rounded outwards, and resamples the
+ * rest of the way with the filter of the segment's scaling command */
+static unsigned int imgtool_geometry_decoded(imgtool_frame_t* frame, imgtool_geometry_t* g, const unsigned int* commands, const unsigned int count)
+{
+    const bmp_t* bitmap = &frame->bitmap;
+    const unsigned int denom = frame->source_denom;
+    imgtool_geometry_solve(g, frame->source_width, frame->source_height, commands, count);
+    unsigned int x1 = (g->x + g->src_width - frame->source_x + denom - 1) / denom;
+    unsigned int y1 = (g->y + g->src_height - frame->source_y + denom - 1) / denom;
+    g->x = (g->x - frame->source_x) / denom;
+    g->y = (g->y - frame->source_y) / denom;
+    if (x1 > bitmap->width) x1 = bitmap->width;
+    if (y1 > bitmap->height) y1 = bitmap->height;
+    g->src_width = x1 > g->x ? x1 - g->x : 1;
+    g->src_height = y1 > g->y ? y1 - g->y : 1;
+    frame->source_width = frame->source_height = 0;
+
+    const unsigned int width = g->width, height = g->height;
+    imgtool_geometry_view(frame, g);
+    if (width != bitmap->width || height != bitmap->height) {
+        bmp_resize_into(bitmap, frame->scratch, width, height, g->filter);
+        imgtool_frame_flip(frame);
+    }
+    imgtool_geometry_orient(frame, g);
+    return imgtool_geometry_segment(commands, count);
+}
+
+static void imgtool_command(unsigned int command, imgtool_frame_t* bitmap)
+{
+    switch (command) {
         case IMG_COMMAND_FLIP_HORIZONTAL: {
-            bmp_swap(bmp_flip_horizontal, bitmap);
+            bmp_flip_horizontal_inplace(&bitmap->bitmap);
             break;
         }
         case IMG_COMMAND_FLIP_VERTICAL: {
-            bmp_swap(bmp_flip_vertical, bitmap);
+            bmp_flip_vertical_inplace(&bitmap->bitmap);
             break;
         }
         case IMG_COMMAND_ROTATE: {
-            bmp_swap(bmp_rotate, bitmap);
+            bmp_pingpong(bmp_rotate, bitmap);
             break;
         }
-        case IMG_COMMAND_SCALE_UP: {
-            bmp_swap(bmp_scale, bitmap);
+        case IMG_COMMAND_ROTATE_180: {
+            bmp_rotate_180_inplace(&bitmap->bitmap);
             break;
         }
-        case IMG_COMMAND_SCALE_DOWN: {
-            bmp_swap(bmp_reduce, bitmap);
-            break;  
+        case IMG_COMMAND_ROTATE_270: {
+            bmp_pingpong(bmp_rotate_270, bitmap);
+            break;
         }
-        case IMG_COMMAND_WHITE_TO_TRANSPARENT: {
-            bmp_swap(bmp_white_to_transparent, bitmap);
+        case IMG_COMMAND_TRANSPOSE: {
+            bmp_pingpong(bmp_transpose, bitmap);
             break;
         }
-        case IMG_COMMAND_WHITE_SENSIBILITY: {
-            bmp_swap_param(bmp_clear_to_transparent, bitmap, (uint8_t)sensibility);
+        case IMG_COMMAND_ROTATE_ANGLE: {
+            imgtool_rotate_angle(bitmap);
+            break;
+        }
+        case IMG_COMMAND_WARP: {
+            bmp_warp_into(&bitmap->bitmap, bitmap->scratch, warp_matrix, warp_filter, warp_border);
+            imgtool_frame_flip(bitmap);
             break;
         }
+        case IMG_COMMAND_BLUR: {
+            if (blur_box) bmp_blur_box_into(&bitmap->bitmap, bitmap->scratch, (unsigned int)blur_radius);
+            else bmp_blur_gauss_into(&bitmap->bitmap, bitmap->scratch, blur_radius);
+            imgtool_frame_flip(bitmap);
+            break;
+        }
+        case IMG_COMMAND_CONVOLVE: {
+            if (convolve_preset >= 0) bmp_convolve_preset_into(&bitmap->bitmap, bitmap->scratch, (img_kernel_enum)convolve_preset);
+            else bmp_convolve_into(&bitmap->bitmap, bitmap->scratch, convolve_kernel, convolve_width, convolve_height, convolve_divisor, convolve_bias);
+            imgtool_frame_flip(bitmap);
+            break;
+        }
+        case IMG_COMMAND_SCALE_UP: {
+            bmp_pingpong(bmp_scale, bitmap);
+            break;
+        }
+        case IMG_COMMAND_SCALE_DOWN: {
+            bmp_pingpong(bmp_reduce, bitmap);
+            break;  
+        }
         case IMG_COMMAND_CUT: {
-            bmp_swap(bmp_cut, bitmap);
+            const bmp_t view = bmp_trim_view(&bitmap->bitmap);
+            memcpy(&bitmap->bitmap, &view, sizeof(bmp_t));
             break;
         }
         case IMG_COMMAND_JCOMPRESS: {
@@ -130,18 +636,71 @@ static void imgtool_command(unsigned int command, bmp_t* bitmap)
             break;
         }
         case IMG_COMMAND_RESIZE_WIDTH: {
-            bmp_swap_param(bmp_resize_width, bitmap, resize_x);
+            bmp_pingpong_param(bmp_resize_width, bitmap, resize_x);
             break;
         }
         case IMG_COMMAND_RESIZE_HEIGHT: {
-            bmp_swap_param(bmp_resize_height, bitmap, resize_y);
+            bmp_pingpong_param(bmp_resize_height, bitmap, resize_y);
             break;
         }
         case IMG_COMMAND_RESIZE_F: {
-            bmp_swap_param(bmp_scale_lerp, bitmap, resize_scale);
+            bmp_pingpong_param(bmp_scale_lerp, bitmap, resize_scale);
             break;
         }
+        case IMG_COMMAND_CROP: {
+            imgtool_crop(&bitmap->bitmap);
+            break;
+        }
+        case IMG_COMMAND_RESIZE: {
+            imgtool_resize(bitmap);
+            break;
+        }
+    }
+}
+
+/* crops as a view and orients once, scaling commands keep their own kernel:
+ * -S and -s commute with the orientation and run before it, -s over the
+ * even rect of the oriented frame, the others run after it; -S -s cancels */
+static void imgtool_geometry_chain(imgtool_frame_t* frame, const unsigned int* commands, const unsigned int count)
+{
+    imgtool_geometry_t g;
+    unsigned int i = 0;
+    if (frame->source_width && frame->source_denom > 1) i = imgtool_geometry_decoded(frame, &g, commands, count);
+    else {
+        const unsigned int width = frame->source_width ? frame->source_width : frame->bitmap.width;
+        const unsigned int height = frame->source_height ? frame->source_height : frame->bitmap.height;
+        memset(&g, 0, sizeof(imgtool_geometry_t));
+        g.src_width = g.width = width;
+        g.src_height = g.height = height;
+    }
+
+    for (; i < count; i++) {
+        const unsigned int command = commands[i];
+        if (command == IMG_COMMAND_SCALE_UP && i + 1 < count && commands[i + 1] == IMG_COMMAND_SCALE_DOWN) {
+            i++;
+            continue;
+        }
+        if (!imgtool_is_scale(command)) {
+            imgtool_geometry_add(&g, command);
+            continue;
+        }
+        if (command == IMG_COMMAND_SCALE_DOWN) {
+            const unsigned int width = (g.transpose ? g.height : g.width) & ~1u;
+            const unsigned int height = (g.transpose ? g.width : g.height) & ~1u;
+            if (width && height) imgtool_geometry_crop(&g, 0, 0, width, height);
+        }
+        imgtool_geometry_view(frame, &g);
+        if (command == IMG_COMMAND_SCALE_UP) bmp_pingpong(bmp_scale, frame);
+        else if (command == IMG_COMMAND_SCALE_DOWN) bmp_pingpong(bmp_reduce, frame);
+        else {
+            imgtool_geometry_orient(frame, &g);
+            imgtool_command(command, frame);
+        }
+        g.src_width = g.width = frame->bitmap.width;
+        g.src_height = g.height = frame->bitmap.height;
     }
+    imgtool_geometry_view(frame, &g);
+    imgtool_geometry_orient(frame, &g);
 }
 
 static char* imgtool_output_strnum(const char* output_path, unsigned int num)
@@ -174,15 +733,17 @@ static long imgtool_file_size(const char* path)
     return ret;
 }
 
-static void imgtool_dump_data(unsigned char* img, unsigned int width, unsigned int height, unsigned int channels)
+static void imgtool_dump_data(const bmp_t* bitmap)
 {
+    const unsigned int width = bitmap->width, height = bitmap->height, channels = bitmap->channels;
     fprintf(stdout, "--------------------------------------------------\n");
     fprintf(stdout, "Width: %u, Height: %u, Channels: %u\n", width, height, channels);
     for (unsigned int y = 0; y < height; y++) {
         for (unsigned int x = 0; x < width; x++) {
-            fprintf(stdout, "(%u", *(img + (width * y + x) * channels));
+            const uint8_t* px = px_at(bitmap, x, y);
+            fprintf(stdout, "(%u", px[0]);
             for (unsigned int i = 1; i < channels; i++) {
-                fprintf(stdout, " %u ", *(img + (width * y + x) * channels + i));
+                fprintf(stdout, " %u ", px[i]);
             }
             fprintf(stdout, ") ");
         }
@@ -202,6 +763,420 @@ static void imgtool_dump_file(bmp_t* bitmap, const char* path)
     fprintf(stdout, "Channels:\t%u\n", bitmap->channels);
 }
 
+/* puts the level, and the image number when there are several, where %d is or before the extension */
+static void imgtool_mips_path(char* dst, const char* pattern, const int number, const unsigned int level)
+{
+    char num[32];
+    if (number < 0) sprintf(num, "%u", level);
+    else sprintf(num, "%03d_%u", number, level);
+
+    const char* at = strstr(pattern, "%d");
+    size_t skip = 2;
+    if (!at) {
+        at = strrchr(pattern, '.');
+        if (!at) at = pattern + strlen(pattern);
+        skip = 0;
+    }
+    snprintf(dst, BUFF_SIZE, "%.*s%s%s", (int)(at - pattern), pattern, num, at + skip);
+}
+
+static void* imgtool_mips_writer(void* arg)
+{
+    imgtool_level_t* level = arg;
+    bmp_write(level->path, level->bitmap);
+    return NULL;
+}
+
+/* builds every level from the previous one, then writes all of them at once */
+static void imgtool_mips(const bmp_t* bitmap, const int number)
+{
+    unsigned int count = 0;
+    bmp_t* pyramid = bmp_pyramid(bitmap, &count);
+    imgtool_level_t* levels = (imgtool_level_t*)malloc((count + 1) * sizeof(imgtool_level_t));
+    if (!levels) {
+        fprintf(stderr, "imgtool could not allocate mipmap levels\n");
+        count = 0;
+    }
+
+    for (unsigned int i = 0; levels && i <= count; i++) {
+        imgtool_mips_path(levels[i].path, mips_path, number, i);
+        levels[i].bitmap = i ? &pyramid[i - 1] : bitmap;
+        levels[i].started = !pthread_create(&levels[i].thread, NULL, imgtool_mips_writer, &levels[i]);
+        if (!levels[i].started) imgtool_mips_writer(&levels[i]);
+    }
+    for (unsigned int i = 0; levels && i <= count; i++) {
+        if (levels[i].started) pthread_join(levels[i].thread, NULL);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        bmp_free(&pyramid[i]);
+    }
+    free(pyramid);
+    free(levels);
+}
+
+/* number is the output number of the image in a batch, or -1 for a single input */
+static void imgtool_apply(const imgtool_program_t* program, imgtool_frame_t* frame, const char* path, const int number)
+{
+    for (unsigned int j = 0; j < program->count; j++) {
+        if (program->commands[j] == IMG_COMMAND_DUMP) {
+            flockfile(stdout);
+            imgtool_dump_file(&frame->bitmap, path);
+            funlockfile(stdout);
+        }
+        else if (program->commands[j] == IMG_COMMAND_FRAME_DUMP) {
+            flockfile(stdout);
+            imgtool_dump_data(&frame->bitmap);
+            funlockfile(stdout);
+        }
+        else if (program->commands[j] == IMG_COMMAND_MIPS) {
+            imgtool_mips(&frame->bitmap, number);
+        }
+        else if (program->fused[j]) {
+            imgtool_pointwise_chain(frame, &program->pointwise[j], program->fused[j]);
+            j += program->fused[j] - 1;
+        }
+        else if (program->geometry[j] > 1 || (program->geometry[j] && frame->source_width)) {
+            imgtool_geometry_chain(frame, &program->commands[j], program->geometry[j]);
+            j += program->geometry[j] - 1;
+        }
+        else imgtool_command(program->commands[j], frame);
+    }
+}
+
+/* pops from the front of the worker's own range, steals from the back of the fullest one */
+static int imgtool_batch_next(imgtool_batch_t* batch, const unsigned int id, unsigned int* index)
+{
+    imgtool_deque_t* own = &batch->deques[id];
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        *index = own->head++;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    while (1) {
+        unsigned int victim = id, most = 0;
+        for (unsigned int i = 0; i < batch->workers; i++) {
+            imgtool_deque_t* d = &batch->deques[i];
+            pthread_mutex_lock(&d->lock);
+            if (d->tail - d->head > most) {
+                most = d->tail - d->head;
+                victim = i;
+            }
+            pthread_mutex_unlock(&d->lock);
+        }
+        if (!most) return 0;
+
+        imgtool_deque_t* d = &batch->deques[victim];
+        pthread_mutex_lock(&d->lock);
+        const int stolen = d->head < d->tail;
+        if (stolen) *index = --d->tail;
+        pthread_mutex_unlock(&d->lock);
+        if (stolen) return 1;
+    }
+}
+
+/* a JPEG the program starts with a geometric run on is decoded only over the
+ * source rect of the run, at 1/2, 1/4 or 1/8 of its size when the run shrinks
+ * it at least that much; the run then resamples the rest of the way */
+static bmp_t imgtool_load(const imgtool_program_t* program, const char* path, imgtool_frame_t* frame)
+{
+    unsigned int width, height, denom = 8;
+    frame->source_width = frame->source_height = 0;
+    if (!program->count || !program->geometry[0] || !jpeg_file_info(path, &width, &height)) return bmp_load(path);
+
+    imgtool_geometry_t g;
+    imgtool_geometry_solve(&g, width, height, program->commands, program->geometry[0]);
+    while (denom > 1 && (g.src_width / denom < g.width || g.src_height / denom < g.height)) {
+        denom /= 2;
+    }
+    if (denom == 1 && g.src_width == width && g.src_height == height) return bmp_load(path);
+
+    const unsigned int x = g.x / denom, y = g.y / denom;
+    unsigned int w = (g.x + g.src_width + denom - 1) / denom - x;
+    unsigned int h = (g.y + g.src_height + denom - 1) / denom - y;
+    uint8_t* pixels = jpeg_file_load_region_scaled(path, x, y, &w, &h, denom);
+    if (!pixels) return bmp_wrap(NULL, 0, 0, 0, 0);
+
+    frame->source_x = x * denom, frame->source_y = y * denom;
+    frame->source_width = width, frame->source_height = height;
+    frame->source_denom = denom;
+    return bmp_wrap(pixels, w, h, 3, w * 3);
+}
+
+/* bytes a frame holds against -max-mem: its pixels and the scratch buffer of
+ * the same size its operations ping-pong into; before decoding they come
+ * from the header, GIF inputs only count once decoded */
+static size_t imgtool_frame_bytes(const char* path, const bmp_t* bitmap)
+{
+    unsigned int width, height;
+    if (bitmap) return bitmap->pixels ? (size_t)bitmap->stride * bitmap->height * 2 : 0;
+    if (png_file_info(path, &width, &height)) return (size_t)width * height * 4 * 2;
+    if (jpeg_file_info(path, &width, &height) || ppm_file_info(path, &width, &height)) return (size_t)width * height * 3 * 2;
+    return 0;
+}
+
+/* waits for room, decodes the image and accounts it as in flight, fails if it can't be loaded */
+static int imgtool_batch_load(imgtool_batch_t* batch, const unsigned int index, imgtool_item_t* item)
+{
+    const char* path = batch->input_path[index];
+    const size_t reserved = batch->max_bytes ? imgtool_frame_bytes(path, NULL) : 0;
+
+    /* wait until the frames in flight leave room for another decode, the first
+     * unresolved input only goes ahead when every frame in flight is parked
+     * waiting on it, since none of them can give its room back before it */
+    pthread_mutex_lock(&batch->lock);
+    while (!(index == batch->resolved && batch->frames == batch->parked) &&
+            ((batch->max_frames && batch->frames >= batch->max_frames) ||
+            (batch->max_bytes && batch->frames && batch->bytes + reserved > batch->max_bytes))) {
+        pthread_cond_wait(&batch->room, &batch->lock);
+    }
+    batch->frames++;
+    batch->bytes += reserved;
+    const unsigned int loaded = ++batch->loaded;
+    if (batch->input_count > 1) fprintf(stdout, "imgtool is loading images... ( %d / %d )\t'%s'\n", loaded, batch->input_count, path);
+    pthread_mutex_unlock(&batch->lock);
+
+    bmp_t bitmap = imgtool_load(batch->program, path, &item->frame);
+    item->index = index;
+    item->size = imgtool_frame_bytes(path, &bitmap);
+    item->frame.bitmap = bitmap;
+    item->frame.buffer = bitmap.pixels;
+    pthread_mutex_lock(&batch->lock);
+    batch->bytes = batch->bytes - reserved + item->size;
+    batch->processed += bitmap.pixels != NULL;
+    if (bitmap.pixels == NULL) batch->frames--;
+
+    /* outputs are numbered among the inputs that decoded, in input order */
+    batch->decoded[index] = bitmap.pixels ? 1 : 2;
+    while (batch->resolved < batch->input_count && batch->decoded[batch->resolved]) {
+        if (batch->decoded[batch->resolved] == 1) batch->numbers[batch->resolved] = batch->numbered++;
+        batch->resolved++;
+    }
+    const int park = bitmap.pixels && batch->resolved <= index;
+    batch->parked += park;
+    pthread_cond_broadcast(&batch->room);
+    while (park && batch->resolved <= index) {
+        pthread_cond_wait(&batch->room, &batch->lock);
+    }
+    batch->parked -= park;
+    pthread_mutex_unlock(&batch->lock);
+    return bitmap.pixels != NULL;
+}
+
+/* encodes the processed frame, frees it and gives its room back */
+static void imgtool_batch_write(imgtool_batch_t* batch, imgtool_item_t* item)
+{
+    const char* path = batch->input_path[item->index];
+    if (batch->output_to_input) bmp_write(path, &item->frame.bitmap);
+    else if (batch->output_count) {
+        if (batch->input_count > 1) {
+            char* output_path_num = imgtool_output_strnum(batch->output_path, batch->numbers[item->index]);
+            bmp_write(output_path_num, &item->frame.bitmap);
+            free(output_path_num);
+        } else bmp_write(batch->output_path, &item->frame.bitmap);
+    }
+    free(item->frame.buffer);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->frames--;
+    batch->bytes -= item->size;
+    pthread_cond_broadcast(&batch->room);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void imgtool_batch_image(imgtool_batch_t* batch, const unsigned int index, bmp_t* scratch)
+{
+    imgtool_item_t item;
+    if (!imgtool_batch_load(batch, index, &item)) return;
+    item.frame.scratch = scratch;
+    imgtool_apply(batch->program, &item.frame, batch->input_path[index], batch->input_count > 1 ? (int)batch->numbers[index] : -1);
+    imgtool_batch_write(batch, &item);
+}
+
+static void* imgtool_batch_worker(void* arg)
+{
+    imgtool_worker_t* worker = arg;
+    bmp_t scratch = {0};
+    unsigned int index;
+    while (imgtool_batch_next(worker->batch, worker->id, &index)) {
+        imgtool_batch_image(worker->batch, index, &scratch);
+    }
+    bmp_free(&scratch);
+    return NULL;
+}
+
+static void imgtool_queue_push(imgtool_queue_t* queue, const imgtool_item_t* item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == IMGTOOL_QUEUE_SIZE) {
+        pthread_cond_wait(&queue->room, &queue->lock);
+    }
+    queue->items[(queue->head + queue->count++) % IMGTOOL_QUEUE_SIZE] = *item;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* blocks until an item arrives, fails once the queue is closed and drained */
+static int imgtool_queue_pop(imgtool_queue_t* queue, imgtool_item_t* item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count && !queue->closed) {
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    }
+    const int popped = queue->count != 0;
+    if (popped) {
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % IMGTOOL_QUEUE_SIZE;
+        queue->count--;
+        pthread_cond_signal(&queue->room);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return popped;
+}
+
+static void imgtool_queue_close(imgtool_queue_t* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void imgtool_queue_init(imgtool_queue_t* queue)
+{
+    queue->head = queue->count = queue->closed = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    pthread_cond_init(&queue->room, NULL);
+}
+
+static void imgtool_queue_destroy(imgtool_queue_t* queue)
+{
+    pthread_cond_destroy(&queue->room);
+    pthread_cond_destroy(&queue->ready);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+static void* imgtool_pipeline_loader(void* arg)
+{
+    imgtool_stage_t* stage = arg;
+    imgtool_item_t item;
+    for (unsigned int i = 0; i < stage->batch->input_count; i++) {
+        if (imgtool_batch_load(stage->batch, i, &item)) {
+            imgtool_queue_push(stage->queue, &item);
+        }
+    }
+    imgtool_queue_close(stage->queue);
+    return NULL;
+}
+
+static void* imgtool_pipeline_writer(void* arg)
+{
+    imgtool_stage_t* stage = arg;
+    imgtool_item_t item;
+    while (imgtool_queue_pop(stage->queue, &item)) {
+        imgtool_batch_write(stage->batch, &item);
+    }
+    return NULL;
+}
+
+/* single stream: decodes image i+1, processes image i and encodes image i-1 at once */
+static int imgtool_pipeline_run(imgtool_batch_t* batch)
+{
+    imgtool_queue_t loaded, processed;
+    imgtool_stage_t loader = {batch, &loaded}, writer = {batch, &processed};
+    pthread_t load_thread, write_thread;
+
+    imgtool_queue_init(&loaded);
+    imgtool_queue_init(&processed);
+    if (pthread_create(&load_thread, NULL, imgtool_pipeline_loader, &loader)) {
+        imgtool_queue_destroy(&processed);
+        imgtool_queue_destroy(&loaded);
+        return 0;
+    }
+    if (pthread_create(&write_thread, NULL, imgtool_pipeline_writer, &writer)) {
+        /* process and write on this thread instead */
+        writer.queue = NULL;
+    }
+
+    bmp_t scratch = {0};
+    imgtool_item_t item;
+    while (imgtool_queue_pop(&loaded, &item)) {
+        item.frame.scratch = &scratch;
+        imgtool_apply(batch->program, &item.frame, batch->input_path[item.index], (int)batch->numbers[item.index]);
+        if (writer.queue) imgtool_queue_push(&processed, &item);
+        else imgtool_batch_write(batch, &item);
+    }
+    bmp_free(&scratch);
+
+    imgtool_queue_close(&processed);
+    pthread_join(load_thread, NULL);
+    if (writer.queue) pthread_join(write_thread, NULL);
+    imgtool_queue_destroy(&processed);
+    imgtool_queue_destroy(&loaded);
+    return 1;
+}
+
+static void imgtool_batch_run(imgtool_batch_t* batch)
+{
+    const unsigned int workers = batch->workers;
+    pthread_t threads[workers];
+    imgtool_worker_t args[workers];
+    imgtool_deque_t deques[workers];
+
+    batch->deques = deques;
+    batch->loaded = batch->processed = batch->resolved = batch->numbered = batch->frames = batch->parked = 0;
+    memset(batch->decoded, 0, batch->input_count);
+    batch->bytes = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->room, NULL);
+    for (unsigned int i = 0; i < workers; i++) {
+        deques[i].head = (unsigned int)((unsigned long)batch->input_count * i / workers);
+        deques[i].tail = (unsigned int)((unsigned long)batch->input_count * (i + 1) / workers);
+        pthread_mutex_init(&deques[i].lock, NULL);
+        args[i].batch = batch;
+        args[i].id = i;
+    }
+
+    /* a single worker overlaps decode, process and encode instead */
+    const int pipelined = workers == 1 && batch->input_count > 1 && imgtool_pipeline_run(batch);
+    unsigned int started = 0;
+    for (unsigned int i = 1; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, imgtool_batch_worker, &args[i])) break;
+        started = i;
+    }
+    if (!pipelined) imgtool_batch_worker(&args[0]);
+    for (unsigned int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (unsigned int i = 0; i < workers; i++) {
+        pthread_mutex_destroy(&deques[i].lock);
+    }
+    pthread_cond_destroy(&batch->room);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+/* parses a byte count with an optional K, M or G suffix, or a frame count ending in f */
+static void imgtool_parse_memory(const char* str, size_t* max_bytes, unsigned int* max_frames)
+{
+    char* end;
+    unsigned long long n = strtoull(str, &end, 10);
+    switch (*end) {
+        case 'f': case 'F': {
+            *max_frames = (unsigned int)n;
+            return;
+        }
+        case 'g': case 'G': n <<= 10; /* fallthrough */
+        case 'm': case 'M': n <<= 10; /* fallthrough */
+        case 'k': case 'K': n <<= 10;
+    }
+    *max_bytes = (size_t)n;
+}
+
 static void imgtool_help()
 {
     fprintf(stdout, "\n**** IMGTOOL: COMMAND LINE HANDY IMAGE TOOL ****\n\n");
@@ -225,8 +1200,16 @@ static void imgtool_help()
     fprintf(stdout, "-j:\t\tCompress image using JPEG compression (lossy).\n");
     fprintf(stdout, "-bw:\t\tTransform to black and white.\n");
     fprintf(stdout, "-N:\t\tTransform to negative RGB values.\n");
-    fprintf(stdout, "-cut:\t\tCut corners of the image when they are transparent.\n");
-    fprintf(stdout, "-r:\t\tRotate by 90 degrees.\n");
+    fprintf(stdout, "-cut:\t\tTrim borders of the top left colour, or transparent borders when it is.\n");
+    fprintf(stdout, "-r:\t\tRotate by 90 degrees clockwise.\n");
+    fprintf(stdout, "-r180:\t\tRotate by 180 degrees.\n");
+    fprintf(stdout, "-r270:\t\tRotate by 270 degrees clockwise.\n");
+    fprintf(stdout, "-transpose:\tSwap rows and columns.\n");
+    fprintf(stdout, "-rotate:\tRotate clockwise by any angle in degrees about the center, DEG[:filter].\n");
+    fprintf(stdout, "-warp:\t\tWarp by a row major a,b,c,d,e,f affine or 3x3 perspective matrix[:filter].\n");
+    fprintf(stdout, "-border:\tWhat -rotate and -warp sample outside the image: zero or clamp.\n");
+    fprintf(stdout, "-blur:\t\tGaussian blur with a standard deviation of R pixels, R:box blurs a box of radius R.\n");
+    fprintf(stdout, "-convolve:\tApply sharpen, edge, emboss, unsharp or a WxH:k,k,...[/divisor][+bias] kernel.\n");
     fprintf(stdout, "-S:\t\tScale up image by factor of two (nearest).\n");
     fprintf(stdout, "-s:\t\tScale down image by factor of two (linear).\n");
     fprintf(stdout, "-fh:\t\tFlip the image horizontally.\n");
@@ -234,9 +1217,18 @@ static void imgtool_help()
     fprintf(stdout, "-Rx:\t\tResize width of image to specified width.\n");
     fprintf(stdout, "-Ry:\t\tResize height of image to specified height.\n");
     fprintf(stdout, "-R:\t\tResize scale of image to specified floating point number.\n");
+    fprintf(stdout, "-resize:\tResample to WxH[:filter], filters are box, triangle, catmull-rom, lanczos3 and area.\n");
+    fprintf(stdout, "-mips:\t\tWrite every mipmap level to a path, %%d is replaced by the level.\n");
+    fprintf(stdout, "-crop:\t\tCrop a WxH+X+Y region of the image without copying it.\n");
     fprintf(stdout, "-t\t\tSet white to transparent. Needs alpha channel present.\n");
     fprintf(stdout, "-T\t\tSet clear colors to transparent with a sensibility between 0 and 255.\n");
     fprintf(stdout, "-q:\t\tSet quality for JPEG compression output when writing to JPG.\n");
+    fprintf(stdout, "-png:\t\tPNG output options, comma separated: level 0-9, none/sub/up/average/paeth/adaptive,\n\t\tdefault/filtered/huffman/rle, fast, parallel, rgba to skip the smallest colour type.\n");
+    fprintf(stdout, "-native:\tKeep grey, grey alpha and RGB PNG inputs as stored instead of widening to RGBA.\n");
+    fprintf(stdout, "-luma:\t\tGrey level weighting for -bw and grey conversions: avg, 601 or 709.\n");
+    fprintf(stdout, "-threads:\tSplit each operation across N threads, 0 uses every core.\n");
+    fprintf(stdout, "-J:\t\tProcess N input images at once, 0 uses every core.\n");
+    fprintf(stdout, "-max-mem:\tLimit decoded frames in flight by bytes (K, M, G) or by count (Nf),\n\t\tbytes count each frame twice for its working buffer.\n");
     fprintf(stdout, "-to-gif:\tWrite output images to a single output GIF file.\n");
     fprintf(stdout, "-from-gif:\tTake every frame of input GIF file as input images.\n");
     fprintf(stdout, "-open:\t\tOpen the first output image after process is completed.\n");
@@ -248,7 +1240,8 @@ int main(int argc, char** argv)
     char input_path[INPUT_SIZE][BUFF_SIZE], output_path[BUFF_SIZE];
     unsigned int commands[INPUT_SIZE], command_count = 0;
     unsigned int output_count = 0, input_count = 0, output_to_gif = 0, input_from_gif = 0;
-    unsigned int output_to_input = 0, open_at_exit = 0, missing_output = 1;
+    unsigned int output_to_input = 0, open_at_exit = 0, missing_output = 1, jobs = 1, max_frames = 0;
+    size_t max_bytes = 0;
 
     if (argc <= 1) {
         fprintf(stderr, "Missing arguments. Use -help to see instructions.\n");
@@ -272,7 +1265,29 @@ int main(int argc, char** argv)
             output_count++;
             missing_output = 0;
             strcpy(output_path, argv[++i]);
-            command_count++;
+            commands[command_count++] = IMG_COMMAND_NULL;
+        }
+        else if (!strcmp(argv[i], "-J") && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (!jobs) jobs = img_cpu_count();
+        }
+        else if (!strcmp(argv[i], "-max-mem") && i + 1 < argc) {
+            imgtool_parse_memory(argv[++i], &max_bytes, &max_frames);
+        }
+        else if (!strcmp(argv[i], "-png") && i + 1 < argc) {
+            imgtool_parse_png(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-native")) {
+            img_set_native_channels(1);
+        }
+        else if (!strcmp(argv[i], "-luma") && i + 1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "601")) img_set_luma(IMG_LUMA_REC601);
+            else if (!strcmp(argv[i], "709")) img_set_luma(IMG_LUMA_REC709);
+            else img_set_luma(IMG_LUMA_AVERAGE);
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            img_set_threads(atoi(argv[++i]));
         }
         else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
             img_set_jpeg_quality(atoi(argv[++i]));
@@ -289,6 +1304,48 @@ int main(int argc, char** argv)
             commands[command_count++] = IMG_COMMAND_RESIZE_F;
             resize_scale = atof(argv[++i]);
         }
+        else if (!strcmp(argv[i], "-resize") && i + 1 < argc) {
+            commands[command_count++] = IMG_COMMAND_RESIZE;
+            char filter[32] = "lanczos3";
+            resize_width = resize_height = 0;
+            if (sscanf(argv[++i], "%ux%u:%31s", &resize_width, &resize_height, filter) < 2) {
+                sscanf(argv[i], "x%u:%31s", &resize_height, filter);
+            }
+            resize_filter = imgtool_parse_filter(filter);
+        }
+        else if (!strcmp(argv[i], "-rotate") && i + 1 < argc) {
+            commands[command_count++] = IMG_COMMAND_ROTATE_ANGLE;
+            rotate_degrees = atof(argv[++i]);
+            const char* filter = strchr(argv[i], ':');
+            if (filter) warp_filter = imgtool_parse_filter(filter + 1);
+        }
+        else if (!strcmp(argv[i], "-warp") && i + 1 < argc) {
+            commands[command_count++] = IMG_COMMAND_WARP;
+            imgtool_parse_warp(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-blur") && i + 1 < argc) {
+            commands[command_count++] = IMG_COMMAND_BLUR;
+            blur_radius = atof(argv[++i]);
+            const char* filter = strchr(argv[i], ':');
+            blur_box = filter && !strcmp(filter + 1, "box");
+        }
+        else if (!strcmp(argv[i], "-convolve") && i + 1 < argc) {
+            commands[command_count++] = IMG_COMMAND_CONVOLVE;
+            imgtool_parse_kernel(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-border") && i + 1 < argc) {
+            warp_border = !strcmp(argv[++i], "clamp") ? IMG_BORDER_CLAMP : IMG_BORDER_ZERO;
+        }
+        else if (!strcmp(argv[i], "-mips") && i + 1 < argc) {
+            missing_output = 0;
+            commands[command_count++] = IMG_COMMAND_MIPS;
+            snprintf(mips_path, BUFF_SIZE, "%s", argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-crop") && i + 1 < argc) {
+            commands[command_count++] = IMG_COMMAND_CROP;
+            crop_width = crop_height = crop_x = crop_y = 0;
+            sscanf(argv[++i], "%ux%u+%u+%u", &crop_width, &crop_height, &crop_x, &crop_y);
+        }
         else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
             commands[command_count++] = IMG_COMMAND_WHITE_SENSIBILITY;
             sensibility = atoi(argv[++i]);
@@ -296,7 +1353,7 @@ int main(int argc, char** argv)
         else if (!strcmp(argv[i], "-n")) {
             missing_output = 0;
             output_count = 0;
-            command_count++;
+            commands[command_count++] = IMG_COMMAND_NULL;
         }
         else if (!strcmp(argv[i], "-N")) {
             commands[command_count++] = IMG_COMMAND_NEGATIVE;
@@ -325,6 +1382,15 @@ int main(int argc, char** argv)
         else if (!strcmp(argv[i], "-r")) {
             commands[command_count++] = IMG_COMMAND_ROTATE;
         }
+        else if (!strcmp(argv[i], "-r180")) {
+            commands[command_count++] = IMG_COMMAND_ROTATE_180;
+        }
+        else if (!strcmp(argv[i], "-r270")) {
+            commands[command_count++] = IMG_COMMAND_ROTATE_270;
+        }
+        else if (!strcmp(argv[i], "-transpose")) {
+            commands[command_count++] = IMG_COMMAND_TRANSPOSE;
+        }
         else if (!strcmp(argv[i], "-S")) {
             commands[command_count++] = IMG_COMMAND_SCALE_UP;
         }
@@ -375,7 +1441,61 @@ int main(int argc, char** argv)
         }
     }
 
-    /* load input image files */
+    /* fuse runs of pointwise commands so each one is a single pass over the frame */
+
+    px_op_t pointwise[INPUT_SIZE];
+    unsigned int fused[INPUT_SIZE];
+    for (unsigned int j = command_count; j-- > 0;) {
+        fused[j] = imgtool_pointwise(commands[j], &pointwise[j]);
+        if (fused[j] && j + 1 < command_count) fused[j] += fused[j + 1];
+    }
+
+    /* and runs of geometric commands so they crop, resample and orient at most once each */
+
+    unsigned int geometry[INPUT_SIZE];
+    for (unsigned int j = command_count; j-- > 0;) {
+        geometry[j] = imgtool_is_geometry(commands[j]);
+        if (geometry[j] && j + 1 < command_count) geometry[j] += geometry[j + 1];
+    }
+    const imgtool_program_t program = {commands, pointwise, fused, geometry, command_count};
+
+    /* stream images through a work stealing pool, each one is loaded, processed, written and freed on its own */
+
+    if (!input_from_gif && !output_to_gif) {
+        unsigned int numbers[INPUT_SIZE];
+        unsigned char decoded[INPUT_SIZE];
+
+        imgtool_batch_t batch;
+        batch.input_path = input_path;
+        batch.output_path = output_path;
+        batch.numbers = numbers;
+        batch.decoded = decoded;
+        batch.program = &program;
+        batch.input_count = input_count;
+        batch.output_count = output_count;
+        batch.output_to_input = output_to_input;
+        batch.workers = jobs < input_count ? jobs : input_count;
+        batch.max_frames = max_frames;
+        batch.max_bytes = max_bytes;
+        imgtool_batch_run(&batch);
+
+        if (!batch.processed) {
+            fprintf(stderr, "imgtool could not load any image file\n");
+            return EXIT_FAILURE;
+        }
+
+        if (output_to_input) imgtool_open_at_exit(open_at_exit, input_path[0]);
+        else if (output_count && open_at_exit) {
+            if (input_count > 1) {
+                char* output_path_num = imgtool_output_strnum(output_path, 0);
+                if (output_path_num) imgtool_open_at_exit(open_at_exit, output_path_num);
+                free(output_path_num);
+            } else imgtool_open_at_exit(open_at_exit, output_path);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    /* load every frame of a GIF, or every input that goes into one */
 
     bmp_t* bitmaps;
     if (input_from_gif) {
@@ -394,7 +1514,16 @@ int main(int argc, char** argv)
         input_count -= miss;
     }
 
-    if (bitmaps[0].pixels == NULL) {
+    bmp_t scratch = {0};
+    imgtool_frame_t* frames = (imgtool_frame_t*)malloc(input_count * sizeof(imgtool_frame_t));
+    for (unsigned int i = 0; i < input_count; i++) {
+        frames[i].bitmap = bitmaps[i];
+        frames[i].buffer = bitmaps[i].pixels;
+        frames[i].scratch = &scratch;
+        frames[i].source_width = frames[i].source_height = 0;
+    }
+
+    if (!input_count || bitmaps[0].pixels == NULL) {
         fprintf(stderr, "imgtool could not load any image file\n");
         return EXIT_FAILURE;
     }
@@ -402,11 +1531,8 @@ int main(int argc, char** argv)
     /* apply commands & operations */
 
     for (unsigned int i = 0; i < input_count; i++) {
-        for (unsigned int j = 0; j < command_count; j++) {
-            if (commands[j] == IMG_COMMAND_DUMP) imgtool_dump_file(&bitmaps[i], input_path[i]);
-            else if (commands[j] == IMG_COMMAND_FRAME_DUMP) imgtool_dump_data(bitmaps[i].pixels, bitmaps[i].width, bitmaps[i].height, bitmaps[i].channels);
-            else imgtool_command(commands[j], &bitmaps[i]);
-        }
+        imgtool_apply(&program, &frames[i], input_path[i], input_count > 1 ? (int)i : -1);
+        bitmaps[i] = frames[i].bitmap;
     }
 
     /* write to output and open */
@@ -415,12 +1541,15 @@ int main(int argc, char** argv)
         gif_t* g = bmp_to_gif(bitmaps, input_count);
         gif_file_write(output_path, g);
         gif_free(g);
+        for (unsigned int i = 0; i < input_count; i++) {
+            free(frames[i].buffer);
+        }
         imgtool_open_at_exit(open_at_exit, output_path);
     }
     else if (output_to_input) {
         for (unsigned int i = 0; i < input_count; i++) {
             bmp_write(input_path[i], &bitmaps[i]);
-            bmp_free(&bitmaps[i]);
+            free(frames[i].buffer);
         }
         imgtool_open_at_exit(open_at_exit, input_path[0]);
     } 
@@ -429,16 +1558,18 @@ int main(int argc, char** argv)
             for (unsigned int i = 0; i < input_count; i++) {
                 char* output_path_num = imgtool_output_strnum(output_path, i);
                 bmp_write(output_path_num, &bitmaps[i]);
-                bmp_free(&bitmaps[i]);
+                free(frames[i].buffer);
             }
             imgtool_open_at_exit(open_at_exit, imgtool_output_strnum(output_path, 0));
         } else {
             bmp_write(output_path, bitmaps);
-            bmp_free(bitmaps);
+            free(frames[0].buffer);
             imgtool_open_at_exit(open_at_exit, output_path);
         }
     } 
     
+    bmp_free(&scratch);
+    free(frames);
     free(bitmaps);
     return EXIT_SUCCESS;
 }
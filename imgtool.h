@@ -58,9 +58,81 @@ typedef uint8_t* px_t;
 
 typedef struct {
     unsigned int width, height, channels;
+    unsigned int stride;    // Bytes per row, views share their parent's stride
     uint8_t* pixels;
 } bmp_t;
 
+typedef enum {
+    IMG_PX_NEGATIVE,
+    IMG_PX_BLACK_AND_WHITE,
+    IMG_PX_WHITE_TO_TRANSPARENT,    // Widens to 4 channels
+    IMG_PX_CLEAR_TO_TRANSPARENT     // Widens to 4 channels, param is sensibility
+} img_px_enum;
+
+typedef enum {
+    IMG_LUMA_AVERAGE,   // (R + G + B) / 3
+    IMG_LUMA_REC601,    // 0.299 R + 0.587 G + 0.114 B
+    IMG_LUMA_REC709     // 0.2126 R + 0.7152 G + 0.0722 B
+} img_luma_enum;
+
+typedef enum {
+    IMG_FILTER_BOX,
+    IMG_FILTER_TRIANGLE,        // Bilinear
+    IMG_FILTER_CATMULL_ROM,     // Bicubic
+    IMG_FILTER_LANCZOS3,
+    IMG_FILTER_AREA             // Exact pixel coverage average, for downscaling
+} img_filter_enum;
+
+typedef enum {
+    IMG_BORDER_ZERO,
+    IMG_BORDER_CLAMP
+} img_border_enum;
+
+typedef enum {
+    IMG_KERNEL_SHARPEN,
+    IMG_KERNEL_EDGE,            // Laplacian, flat areas go black
+    IMG_KERNEL_EMBOSS,
+    IMG_KERNEL_UNSHARP          // 5x5 gaussian unsharp mask
+} img_kernel_enum;
+
+typedef enum {
+    IMG_PNG_FILTER_NONE,
+    IMG_PNG_FILTER_SUB,
+    IMG_PNG_FILTER_UP,
+    IMG_PNG_FILTER_AVERAGE,
+    IMG_PNG_FILTER_PAETH,
+    IMG_PNG_FILTER_ADAPTIVE     // Per row, smallest sum of signed bytes
+} img_png_filter_enum;
+
+typedef enum {
+    IMG_PNG_STRATEGY_AUTO,      // Filtered when rows are filtered, as libpng does
+    IMG_PNG_STRATEGY_DEFAULT,
+    IMG_PNG_STRATEGY_FILTERED,
+    IMG_PNG_STRATEGY_HUFFMAN,
+    IMG_PNG_STRATEGY_RLE
+} img_png_strategy_enum;
+
+typedef struct {
+    int level;                          // zlib level 0 to 9, -1 for its default
+    img_png_strategy_enum strategy;
+    img_png_filter_enum filter;
+    int fast;                           // level 1, sub filter and run lengths
+    int parallel;                       // Filter and deflate strips of large images on the pool
+    int rgba;                           // Always RGBA instead of the smallest lossless colour type
+} img_png_options_t;
+
+typedef struct {
+    img_px_enum op;
+    uint8_t param;
+} px_op_t;
+
+/* (width + 1) x (height + 1) running sums of every channel, the first row and
+ * column are zero so any rectangle sums in four lookups */
+typedef struct {
+    unsigned int width, height, channels;
+    uint64_t* sums;
+} sat_t;
+
 typedef struct {
     unsigned int size, used, width, height;
     uint8_t** frames;
@@ -72,24 +144,44 @@ typedef struct {
 ***********************/
 
 uint8_t* img_file_load(const char* path, unsigned int* width, unsigned int* height, unsigned int* out_channels);
+uint8_t* img_file_load_scaled(const char* path, unsigned int* width, unsigned int* height, unsigned int* out_channels, const unsigned int denom);
 void img_file_write(const char* path, const uint8_t* img, const unsigned int width, const unsigned int height, const unsigned int in_channels);
 
 void img_set_jpeg_quality(const int quality);
+void img_set_native_channels(const int native);     // PNG loads keep G, GA and RGB as stored
 uint8_t* img_jcompress(const uint8_t* img, const unsigned int width, const unsigned int height, const unsigned int channels, const unsigned int quality);
 uint8_t* img_transform_buffer(const uint8_t* buffer, const unsigned int width, const unsigned int height, const unsigned int src, const unsigned int dest);
 
+/***********************
+ -> Threads and pools  <-
+***********************/
+
+void img_set_threads(const unsigned int threads);   // 0 uses every online CPU
+unsigned int img_get_threads(void);
+unsigned int img_cpu_count(void);
+
 /***********************
  -> PNG save and load <- 
 ***********************/
 
 uint8_t* png_file_load(const char* path, unsigned int* width, unsigned int* height);
+uint8_t* png_file_load_native(const char* path, unsigned int* width, unsigned int* height, unsigned int* channels);
+int png_file_info(const char* path, unsigned int* width, unsigned int* height);
 void png_file_write(const char* path, const uint8_t* data, const unsigned int width, const unsigned int height);
+void img_set_png_options(const img_png_options_t* options);
+img_png_options_t img_get_png_options(void);
 
 /************************
  -> JPEG save and load <- 
 ************************/
 
 uint8_t* jpeg_file_load(const char* path, unsigned int* w, unsigned int* h);
+uint8_t* jpeg_file_load_scaled(const char* path, unsigned int* w, unsigned int* h, const unsigned int denom);  // 1, 2, 4 or 8
+int jpeg_file_info(const char* path, unsigned int* w, unsigned int* h);
+/* decode only the w x h window at x, y, clipped to the image, 0 for w or h reaches the edge;
+ * the scaled variant takes the window in pixels of the image scaled by 1 / denom */
+uint8_t* jpeg_file_load_region(const char* path, const unsigned int x, const unsigned int y, unsigned int* w, unsigned int* h);
+uint8_t* jpeg_file_load_region_scaled(const char* path, const unsigned int x, const unsigned int y, unsigned int* w, unsigned int* h, const unsigned int denom);
 void jpeg_file_write(const char* path, const uint8_t* data, const unsigned int width, const unsigned int height, const int quality);
 uint8_t* jpeg_compress(const uint8_t* data, unsigned int* size, const unsigned int width, const unsigned height, const int quality);
 uint8_t* jpeg_decompress(const uint8_t* data, const unsigned int size);
@@ -99,6 +191,7 @@ uint8_t* jpeg_decompress(const uint8_t* data, const unsigned int size);
 ************************/
 
 uint8_t* ppm_file_load(const char* path, unsigned int* width, unsigned int* height);
+int ppm_file_info(const char* path, unsigned int* width, unsigned int* height);
 void ppm_file_write(const char* path, const uint8_t* img, const unsigned int width, const unsigned int height);
 
 /*************************
@@ -118,10 +211,15 @@ gif_t* bmp_to_gif(const bmp_t* bitmaps, const unsigned int count);
  -> Greyscale, RGB and RGBA <-
  ****************************/
 
+void img_set_luma(const img_luma_enum luma);   // Weights used by every colour to grey conversion
+img_luma_enum img_get_luma(void);
+
 uint8_t* rgba_to_greyscale(const uint8_t* buffer, const unsigned int width, const unsigned int height);
 uint8_t* rgb_to_greyscale(const uint8_t* buffer, const unsigned int width, const unsigned int height);
 uint8_t* rgb_to_rgba(const uint8_t* buffer, const unsigned int width, const unsigned int height);
 uint8_t* rgba_to_rgb(const uint8_t* buffer, const unsigned int width, const unsigned int height);
+uint8_t* greyscale_to_rgb(const uint8_t* buffer, const unsigned int width, const unsigned int height);
+uint8_t* greyscale_to_rgba(const uint8_t* buffer, const unsigned int width, const unsigned int height);
 
 /***************************
  -> Bitmap Data Structure <-
@@ -129,10 +227,14 @@ uint8_t* rgba_to_rgb(const uint8_t* buffer, const unsigned int width, const unsi
 
 uint8_t* px_at(const bmp_t* bitmap, const unsigned int x, const unsigned int y);
 bmp_t bmp_new(const unsigned int width, const unsigned int height, const unsigned int channels);
+void bmp_reserve(bmp_t* bitmap, const unsigned int width, const unsigned int height, const unsigned int channels);
 bmp_t bmp_color(const unsigned int width, const unsigned int height, const unsigned int channels, const uint8_t* color);
 bmp_t bmp_load(const char* path);
+bmp_t bmp_load_scaled(const char* path, const unsigned int denom);     // JPEGs decode at 1 / denom, others in full
 void bmp_write(const char* path, const bmp_t* bitmap);
 bmp_t bmp_copy(const bmp_t* bmp);
+bmp_t bmp_view(const bmp_t* bmp, const unsigned int x, const unsigned int y, const unsigned int width, const unsigned int height);
+bmp_t bmp_wrap(uint8_t* pixels, const unsigned int width, const unsigned int height, const unsigned int channels, const unsigned int stride);
 void bmp_free(bmp_t* bitmap);
 
 /**************************************
@@ -144,10 +246,15 @@ bmp_t bmp_flip_vertical(const bmp_t* bitmap);
 bmp_t bmp_flip_horizontal(const bmp_t* bitmap);
 bmp_t bmp_black_and_white(const bmp_t* bitmap);
 bmp_t bmp_greyscale(const bmp_t* bitmap);
-bmp_t bmp_rotate(const bmp_t* bitmap);
+bmp_t bmp_rotate(const bmp_t* bitmap);       // a quarter turn clockwise
+bmp_t bmp_rotate_180(const bmp_t* bitmap);
+bmp_t bmp_rotate_270(const bmp_t* bitmap);
+bmp_t bmp_transpose(const bmp_t* bitmap);
+bmp_t bmp_transverse(const bmp_t* bitmap);   // transpose across the other diagonal
 bmp_t bmp_scale(const bmp_t* bitmap);
 bmp_t bmp_white_to_transparent(const bmp_t* bitmap);
 bmp_t bmp_cut(const bmp_t* bitmap);
+bmp_t bmp_trim_view(const bmp_t* bitmap);
 bmp_t bmp_reduce(const bmp_t* bitmap);
 bmp_t bmp_clear_to_transparent(const bmp_t* bitmap, const uint8_t sensibility);
 bmp_t bmp_transform(const bmp_t* bitmap, const unsigned int channels);
@@ -157,6 +264,99 @@ bmp_t bmp_resize_width(const bmp_t* bmp, const unsigned int target_width);
 bmp_t bmp_resize_height(const bmp_t* bmp, const unsigned int target_height);
 bmp_t bmp_scale_lerp(const bmp_t* bmp, const float f);
 
+/*********************************************
+ -> In-place and buffer reusing operations  <-
+ ********************************************/
+
+void bmp_negative_inplace(bmp_t* bitmap);
+void bmp_flip_vertical_inplace(bmp_t* bitmap);
+void bmp_flip_horizontal_inplace(bmp_t* bitmap);
+void bmp_black_and_white_inplace(bmp_t* bitmap);
+void bmp_rotate_180_inplace(bmp_t* bitmap);
+void bmp_white_to_transparent_inplace(bmp_t* bitmap);                             // RGBA only
+void bmp_clear_to_transparent_inplace(bmp_t* bitmap, const uint8_t sensibility);   // RGBA only
+
+/* dst must own its pixels or be zeroed, it is resized with bmp_reserve */
+void bmp_greyscale_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_rotate_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_rotate_270_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_transpose_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_transverse_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_scale_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_white_to_transparent_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_cut_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_reduce_into(const bmp_t* bitmap, bmp_t* dst);
+void bmp_clear_to_transparent_into(const bmp_t* bitmap, bmp_t* dst, const uint8_t sensibility);
+void bmp_resize_width_into(const bmp_t* bmp, bmp_t* dst, const unsigned int target_width);
+void bmp_resize_height_into(const bmp_t* bmp, bmp_t* dst, const unsigned int target_height);
+void bmp_scale_lerp_into(const bmp_t* bmp, bmp_t* dst, const float f);
+
+/********************************
+ -> Fused pointwise operations <-
+ *******************************/
+
+/* runs a chain of pointwise ops over each row while it is still in cache */
+unsigned int px_op_channels(const unsigned int channels, const px_op_t* ops, const unsigned int count);
+void bmp_pointwise_inplace(bmp_t* bitmap, const px_op_t* ops, const unsigned int count); // channels must not widen
+void bmp_pointwise_into(const bmp_t* bitmap, bmp_t* dst, const px_op_t* ops, const unsigned int count);
+bmp_t bmp_pointwise(const bmp_t* bitmap, const px_op_t* ops, const unsigned int count);
+
+/**************************
+ -> Filtered resampling  <-
+ *************************/
+
+/* separable resize, the per axis weights are computed once per call */
+void bmp_resize_into(const bmp_t* bitmap, bmp_t* dst, const unsigned int width, const unsigned int height, const img_filter_enum filter);
+bmp_t bmp_resize(const bmp_t* bitmap, const unsigned int width, const unsigned int height, const img_filter_enum filter);
+
+/* halves the bitmap down to 1x1 or up to *levels times (0 means no limit), the
+ * base level is not included and *levels is set to the number of levels built */
+bmp_t* bmp_pyramid(const bmp_t* bitmap, unsigned int* levels);
+
+/*********************
+ -> Geometric warps <-
+ ********************/
+
+/* matrix is a row major 3x3 that maps source pixel coordinates to the output,
+ * a third row of 0 0 1 is affine; box samples nearest, triangle bilinear and
+ * the other filters bicubic, outside the source is zero or the clamped edge */
+void bmp_warp_into(const bmp_t* bitmap, bmp_t* dst, const float* matrix, const img_filter_enum filter, const img_border_enum border);
+bmp_t bmp_warp(const bmp_t* bitmap, const float* matrix, const img_filter_enum filter, const img_border_enum border);
+
+/******************
+ -> Blur filters <-
+ *****************/
+
+/* separable running sums, the cost does not depend on the radius; the gaussian
+ * is three box passes and edges repeat the outermost pixels */
+void bmp_blur_box_into(const bmp_t* bitmap, bmp_t* dst, const unsigned int radius);
+bmp_t bmp_blur_box(const bmp_t* bitmap, const unsigned int radius);
+void bmp_blur_gauss_into(const bmp_t* bitmap, bmp_t* dst, const float sigma);
+bmp_t bmp_blur_gauss(const bmp_t* bitmap, const float sigma);
+
+/*****************
+ -> Convolution <-
+ ****************/
+
+/* kernel is kw x kh row major with its center at kw / 2, kh / 2, sums are divided
+ * by divisor (0 uses the kernel sum) and biased; edges repeat the outermost
+ * pixels, alpha is kept and rank one kernels run as two 1D passes */
+void bmp_convolve_into(const bmp_t* bitmap, bmp_t* dst, const int* kernel, const unsigned int kw, const unsigned int kh, int divisor, const int bias);
+bmp_t bmp_convolve(const bmp_t* bitmap, const int* kernel, const unsigned int kw, const unsigned int kh, const int divisor, const int bias);
+void bmp_convolve_preset_into(const bmp_t* bitmap, bmp_t* dst, const img_kernel_enum preset);
+bmp_t bmp_convolve_preset(const bmp_t* bitmap, const img_kernel_enum preset);
+
+/*************************
+ -> Summed area tables  <-
+ ************************/
+
+/* built with a parallel pass over rows and one over column strips, rectangles
+ * are clipped to the bitmap and the mean of an empty one is zero */
+sat_t sat_new(const bmp_t* bitmap);
+void sat_free(sat_t* sat);
+void sat_rect(const sat_t* sat, unsigned int x, unsigned int y, unsigned int width, unsigned int height, uint64_t* sums);
+void sat_mean(const sat_t* sat, unsigned int x, unsigned int y, unsigned int width, unsigned int height, uint8_t* px);
+
 #ifdef __cplusplus
 }
 #endif
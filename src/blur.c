@@ -0,0 +1,352 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "thread.h"
+#include "simd.h"
+
+/******************
+ -> Blur filters <-
+ *****************/
+
+#define BLUR_PASSES 3
+#define BLUR_STRIP 64
+#define BLUR_MAX_RADIUS 32767
+
+/* every pass is a box of its own radius with clamped edges, sums are exact
+ * integers and each pass rounds its average back to 8 bits */
+typedef struct {
+    const bmp_t* src;
+    bmp_t* dst;
+    unsigned int radius[BLUR_PASSES];
+    unsigned int passes;
+} blur_job_t;
+
+static float blur_scale(const unsigned int radius)
+{
+    return 1.0F / (float)(2 * radius + 1);
+}
+
+/* stores the averages of count column sums and slides the window a row down */
+static void blur_step_scalar(uint32_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* out, const size_t count, const float scale)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (uint8_t)(sums[i] * scale + 0.5F);
+        sums[i] += add[i] - sub[i];
+    }
+}
+
+/* one pass along a packed row, every channel keeps its own running sum */
+static void blur_row_scalar(const uint8_t* src, uint8_t* dst, const unsigned int width, const unsigned int channels, const unsigned int radius)
+{
+    const unsigned int last = width - 1, n = radius < last ? radius : last;
+    const float scale = blur_scale(radius);
+    for (unsigned int c = 0; c < channels; c++) {
+        const uint8_t* p = src + c;
+        uint32_t sum = (radius + 1) * p[0] + (radius - n) * p[(size_t)last * channels];
+        for (unsigned int k = 1; k <= n; k++) {
+            sum += p[(size_t)k * channels];
+        }
+        for (unsigned int x = 0; x < width; x++) {
+            const unsigned int a = x + radius < last ? x + radius + 1 : last;
+            const unsigned int b = x > radius ? x - radius : 0;
+            dst[(size_t)x * channels + c] = (uint8_t)(sum * scale + 0.5F);
+            sum += p[(size_t)a * channels] - p[(size_t)b * channels];
+        }
+    }
+}
+
+#if defined(IMG_SIMD_SSSE3)
+
+/* sums stay below 2^24, so the float averages round exactly */
+IMG_TARGET_SSSE3
+static size_t ssse3_blur_step(uint32_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* out, const size_t count, const float scale)
+{
+    const __m128 k = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i* s = (__m128i*)(void*)(sums + i);
+        __m128i q[4];
+        for (int j = 0; j < 4; j++) {
+            q[j] = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(s + j)), k));
+        }
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+
+        const __m128i a = _mm_loadu_si128((const __m128i*)(add + i)), b = _mm_loadu_si128((const __m128i*)(sub + i));
+        const __m128i d[2] = {
+            _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+            _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero))
+        };
+        for (int j = 0; j < 4; j++) {
+            const __m128i h = d[j >> 1], sign = _mm_srai_epi16(h, 15);
+            const __m128i w = j & 1 ? _mm_unpackhi_epi16(h, sign) : _mm_unpacklo_epi16(h, sign);
+            _mm_storeu_si128(s + j, _mm_add_epi32(_mm_loadu_si128(s + j), w));
+        }
+    }
+    return i;
+}
+
+IMG_TARGET_SSSE3
+static __m128i ssse3_px32(const uint8_t* p)
+{
+    int value;
+    memcpy(&value, p, 4);
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+}
+
+/* the four channels of a pixel share one vector of sums */
+IMG_TARGET_SSSE3
+static void ssse3_blur_row(const uint8_t* src, uint8_t* dst, const unsigned int width, const unsigned int radius)
+{
+    const unsigned int last = width - 1, n = radius < last ? radius : last;
+    const __m128 k = _mm_set1_ps(blur_scale(radius));
+    uint32_t init[4];
+    for (unsigned int c = 0; c < 4; c++) {
+        init[c] = (radius + 1) * src[c] + (radius - n) * src[(size_t)last * 4 + c];
+        for (unsigned int i = 1; i <= n; i++) {
+            init[c] += src[(size_t)i * 4 + c];
+        }
+    }
+    __m128i sum = _mm_loadu_si128((const __m128i*)(void*)init);
+    for (unsigned int x = 0; x < width; x++) {
+        const unsigned int a = x + radius < last ? x + radius + 1 : last;
+        const unsigned int b = x > radius ? x - radius : 0;
+        const __m128i q = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), k));
+        const int value = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(q, q), q));
+        memcpy(dst + (size_t)x * 4, &value, 4);
+        sum = _mm_add_epi32(sum, _mm_sub_epi32(ssse3_px32(src + (size_t)a * 4), ssse3_px32(src + (size_t)b * 4)));
+    }
+}
+
+static size_t simd_blur_step(uint32_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* out, const size_t count, const float scale)
+{
+    if (!img_simd_ssse3()) return 0;
+    return ssse3_blur_step(sums, add, sub, out, count, scale);
+}
+
+static int simd_blur_row(const uint8_t* src, uint8_t* dst, const unsigned int width, const unsigned int channels, const unsigned int radius)
+{
+    if (channels != 4 || !img_simd_ssse3()) return 0;
+    ssse3_blur_row(src, dst, width, radius);
+    return 1;
+}
+
+#elif defined(IMG_SIMD_NEON)
+
+static size_t simd_blur_step(uint32_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* out, const size_t count, const float scale)
+{
+    const float32x4_t k = vdupq_n_f32(scale), half = vdupq_n_f32(0.5F);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint16x4_t q[4];
+        for (int j = 0; j < 4; j++) {
+            const float32x4_t f = vaddq_f32(vmulq_f32(vcvtq_f32_u32(vld1q_u32(sums + i + j * 4)), k), half);
+            q[j] = vmovn_u32(vcvtq_u32_f32(f));
+        }
+        const uint8x16_t px = vcombine_u8(vmovn_u16(vcombine_u16(q[0], q[1])), vmovn_u16(vcombine_u16(q[2], q[3])));
+        vst1q_u8(out + i, px);
+
+        const uint8x16_t a = vld1q_u8(add + i), b = vld1q_u8(sub + i);
+        const int16x8_t lo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(a), vget_low_u8(b)));
+        const int16x8_t hi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(a), vget_high_u8(b)));
+        const int16x4_t d[4] = {vget_low_s16(lo), vget_high_s16(lo), vget_low_s16(hi), vget_high_s16(hi)};
+        for (int j = 0; j < 4; j++) {
+            const int32x4_t s = vreinterpretq_s32_u32(vld1q_u32(sums + i + j * 4));
+            vst1q_u32(sums + i + j * 4, vreinterpretq_u32_s32(vaddw_s16(s, d[j])));
+        }
+    }
+    return i;
+}
+
+static int32x4_t neon_px32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(value))))));
+}
+
+static int simd_blur_row(const uint8_t* src, uint8_t* dst, const unsigned int width, const unsigned int channels, const unsigned int radius)
+{
+    if (channels != 4) return 0;
+    const unsigned int last = width - 1, n = radius < last ? radius : last;
+    const float32x4_t k = vdupq_n_f32(blur_scale(radius)), half = vdupq_n_f32(0.5F);
+    uint32_t init[4];
+    for (unsigned int c = 0; c < 4; c++) {
+        init[c] = (radius + 1) * src[c] + (radius - n) * src[(size_t)last * 4 + c];
+        for (unsigned int i = 1; i <= n; i++) {
+            init[c] += src[(size_t)i * 4 + c];
+        }
+    }
+    int32x4_t sum = vreinterpretq_s32_u32(vld1q_u32(init));
+    for (unsigned int x = 0; x < width; x++) {
+        const unsigned int a = x + radius < last ? x + radius + 1 : last;
+        const unsigned int b = x > radius ? x - radius : 0;
+        const uint16x4_t q = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(vcvtq_f32_s32(sum), k), half)));
+        vst1_lane_u32((uint32_t*)(void*)(dst + (size_t)x * 4), vreinterpret_u32_u8(vmovn_u16(vcombine_u16(q, q))), 0);
+        sum = vaddq_s32(sum, vsubq_s32(neon_px32(src + (size_t)a * 4), neon_px32(src + (size_t)b * 4)));
+    }
+    return 1;
+}
+
+#else
+
+static size_t simd_blur_step(uint32_t* sums, const uint8_t* add, const uint8_t* sub, uint8_t* out, const size_t count, const float scale)
+{
+    (void)sums, (void)add, (void)sub, (void)out, (void)count, (void)scale;
+    return 0;
+}
+
+static int simd_blur_row(const uint8_t* src, uint8_t* dst, const unsigned int width, const unsigned int channels, const unsigned int radius)
+{
+    (void)src, (void)dst, (void)width, (void)channels, (void)radius;
+    return 0;
+}
+
+#endif
+
+/* one pass down a strip of count bytes, in and out rows are stride bytes apart */
+static void blur_column(const uint8_t* in, const size_t in_stride, uint8_t* out, const size_t out_stride, const size_t count, const unsigned int height, const unsigned int radius, uint32_t* sums)
+{
+    const unsigned int last = height - 1, n = radius < last ? radius : last;
+    const float scale = blur_scale(radius);
+    for (size_t i = 0; i < count; i++) {
+        sums[i] = (radius + 1) * in[i] + (radius - n) * in[(size_t)last * in_stride + i];
+    }
+    for (unsigned int k = 1; k <= n; k++) {
+        for (size_t i = 0; i < count; i++) {
+            sums[i] += in[(size_t)k * in_stride + i];
+        }
+    }
+    for (unsigned int y = 0; y < height; y++) {
+        const uint8_t* add = in + (size_t)(y + radius < last ? y + radius + 1 : last) * in_stride;
+        const uint8_t* sub = in + (size_t)(y > radius ? y - radius : 0) * in_stride;
+        uint8_t* dst = out + (size_t)y * out_stride;
+        const size_t i = simd_blur_step(sums, add, sub, dst, count, scale);
+        blur_step_scalar(sums + i, add + i, sub + i, dst + i, count - i, scale);
+    }
+}
+
+/* every pass of a strip runs before the next strip, so the strip stays in cache */
+static void blur_columns(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const blur_job_t* job = arg;
+    const bmp_t* src = job->src;
+    bmp_t* dst = job->dst;
+    const unsigned int height = src->height, passes = job->passes;
+    const size_t size = (size_t)src->width * src->channels, area = (size_t)BLUR_STRIP * height;
+    uint8_t* buffer = NULL;
+    if (passes > 1 && !(buffer = malloc(area * 2))) {
+        fprintf(stderr, "imgtool could not allocate memory for blurring\n");
+        return;
+    }
+
+    uint32_t sums[BLUR_STRIP];
+    for (unsigned int s = begin; s < end; s++) {
+        const size_t offset = (size_t)s * BLUR_STRIP;
+        const size_t count = size - offset < BLUR_STRIP ? size - offset : BLUR_STRIP;
+        for (unsigned int pass = 0; pass < passes; pass++) {
+            const int first = pass == 0, final = pass + 1 == passes;
+            const uint8_t* in = first ? row_at(src, 0) + offset : buffer + ((pass - 1) & 1) * area;
+            uint8_t* out = final ? row_at(dst, 0) + offset : buffer + (pass & 1) * area;
+            blur_column(in, first ? src->stride : BLUR_STRIP, out, final ? dst->stride : BLUR_STRIP, count, height, job->radius[pass], sums);
+        }
+    }
+    free(buffer);
+}
+
+/* rows are blurred in place, each one is copied out first */
+static void blur_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const blur_job_t* job = arg;
+    bmp_t* dst = job->dst;
+    const unsigned int width = dst->width, channels = dst->channels;
+    const size_t size = (size_t)width * channels;
+    uint8_t* buffer = malloc(size * 2);
+    if (!buffer) {
+        fprintf(stderr, "imgtool could not allocate memory for blurring\n");
+        return;
+    }
+
+    for (unsigned int y = begin; y < end; y++) {
+        memcpy(buffer, row_at(dst, y), size);
+        for (unsigned int pass = 0; pass < job->passes; pass++) {
+            const uint8_t* in = buffer + (pass & 1) * size;
+            uint8_t* out = pass + 1 == job->passes ? row_at(dst, y) : buffer + ((pass + 1) & 1) * size;
+            if (!simd_blur_row(in, out, width, channels, job->radius[pass])) {
+                blur_row_scalar(in, out, width, channels, job->radius[pass]);
+            }
+        }
+    }
+    free(buffer);
+}
+
+static void blur_copy_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const blur_job_t* job = arg;
+    for (unsigned int y = begin; y < end; y++) {
+        memcpy(row_at(job->dst, y), row_at(job->src, y), (size_t)job->src->width * job->src->channels);
+    }
+}
+
+static void blur_into(const bmp_t* bitmap, bmp_t* dst, const unsigned int* radius, const unsigned int count)
+{
+    blur_job_t job = {bitmap, dst, {0}, 0};
+    for (unsigned int i = 0; i < count; i++) {
+        if (radius[i]) job.radius[job.passes++] = radius[i] < BLUR_MAX_RADIUS ? radius[i] : BLUR_MAX_RADIUS;
+    }
+
+    bmp_reserve(dst, bitmap->width, bitmap->height, bitmap->channels);
+    const size_t size = (size_t)dst->width * dst->channels;
+    if (!size || !dst->height) return;
+    if (!job.passes) {
+        img_parallel_for(blur_copy_rows, &job, dst->height, row_grain(size));
+        return;
+    }
+
+    const unsigned int strips = (unsigned int)((size + BLUR_STRIP - 1) / BLUR_STRIP);
+    img_parallel_for(blur_columns, &job, strips, row_grain((size_t)BLUR_STRIP * dst->height));
+    img_parallel_for(blur_rows, &job, dst->height, row_grain(size));
+}
+
+/* three boxes whose variances add up to sigma squared */
+static void blur_gauss_radii(const float sigma, unsigned int* radius)
+{
+    const double v = 12.0 * sigma * sigma, ideal = sqrt(v / BLUR_PASSES + 1.0);
+    int lower = (int)floor(ideal);
+    if (lower % 2 == 0) lower--;
+    const double m = (v - BLUR_PASSES * (double)lower * lower - 4.0 * BLUR_PASSES * lower - 3.0 * BLUR_PASSES) / (-4.0 * lower - 4.0);
+    const int count = (int)floor(m + 0.5);
+    for (int i = 0; i < BLUR_PASSES; i++) {
+        const int size = i < count ? lower : lower + 2;
+        radius[i] = (unsigned int)(size - 1) / 2;
+    }
+}
+
+void bmp_blur_box_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const unsigned int radius)
+{
+    blur_into(bitmap, dst, &radius, 1);
+}
+
+bmp_t bmp_blur_box(const bmp_t* restrict bitmap, const unsigned int radius)
+{
+    bmp_t new_bitmap = {0};
+    bmp_blur_box_into(bitmap, &new_bitmap, radius);
+    return new_bitmap;
+}
+
+void bmp_blur_gauss_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const float sigma)
+{
+    unsigned int radius[BLUR_PASSES] = {0};
+    if (sigma > 0.0F) blur_gauss_radii(sigma < BLUR_MAX_RADIUS ? sigma : BLUR_MAX_RADIUS, radius);
+    blur_into(bitmap, dst, radius, BLUR_PASSES);
+}
+
+bmp_t bmp_blur_gauss(const bmp_t* restrict bitmap, const float sigma)
+{
+    bmp_t new_bitmap = {0};
+    bmp_blur_gauss_into(bitmap, &new_bitmap, sigma);
+    return new_bitmap;
+}
@@ -8,7 +8,7 @@
 
 uint8_t* px_at(const bmp_t* restrict bmp, const unsigned int x, const unsigned int y)
 {
-    return bmp->pixels + (bmp->width * y + x) * bmp->channels;
+    return bmp->pixels + (size_t)bmp->stride * y + x * bmp->channels;
 }
 
 bmp_t bmp_new(const unsigned int width, const unsigned int height, const unsigned int channels)
@@ -18,28 +18,67 @@ bmp_t bmp_new(const unsigned int width, const unsigned int height, const unsigne
     bitmap.channels = channels;
     bitmap.height = height;
     bitmap.width = width;
+    bitmap.stride = width * channels;
     return bitmap;
 }
 
+void bmp_reserve(bmp_t* bitmap, const unsigned int width, const unsigned int height, const unsigned int channels)
+{
+    bitmap->pixels = realloc(bitmap->pixels, (size_t)width * height * channels);
+    bitmap->channels = channels;
+    bitmap->height = height;
+    bitmap->width = width;
+    bitmap->stride = width * channels;
+}
+
 bmp_t bmp_copy(const bmp_t* restrict bmp)
 {
     bmp_t ret;
     ret.width = bmp->width;
     ret.height = bmp->height;
     ret.channels = bmp->channels;
+    ret.stride = ret.width * ret.channels;
     
-    const size_t size = ret.width * ret.height * ret.channels;
+    const size_t size = ret.stride * ret.height;
     ret.pixels = calloc(size, 1);
-    memcpy(ret.pixels, bmp->pixels, size);
+    if (bmp->stride == ret.stride) {
+        memcpy(ret.pixels, bmp->pixels, size);
+    } else {
+        for (unsigned int y = 0; y < ret.height; y++) {
+            memcpy(ret.pixels + (size_t)ret.stride * y, px_at(bmp, 0, y), ret.stride);
+        }
+    }
     return ret;
 }
 
+bmp_t bmp_view(const bmp_t* restrict bmp, const unsigned int x, const unsigned int y, const unsigned int width, const unsigned int height)
+{
+    bmp_t view;
+    view.width = width;
+    view.height = height;
+    view.channels = bmp->channels;
+    view.stride = bmp->stride;
+    view.pixels = px_at(bmp, x, y);
+    return view;
+}
+
+bmp_t bmp_wrap(uint8_t* pixels, const unsigned int width, const unsigned int height, const unsigned int channels, const unsigned int stride)
+{
+    bmp_t bitmap;
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.channels = channels;
+    bitmap.stride = stride ? stride : width * channels;
+    bitmap.pixels = pixels;
+    return bitmap;
+}
+
 bmp_t bmp_color(const unsigned int width, const unsigned int height, const unsigned int channels, const uint8_t* restrict color)
 {
     bmp_t bitmap = bmp_new(width, height, channels);
     for (unsigned int y = 0; y < height; y ++) {
         for (unsigned int x = 0; x < width; x ++) {
-            memcpy(bitmap.pixels + (width * y + x) * bitmap.channels, color, channels);
+            memcpy(px_at(&bitmap, x, y), color, channels);
         }
     }
     return bitmap;
@@ -47,14 +86,24 @@ bmp_t bmp_color(const unsigned int width, const unsigned int height, const unsig
 
 bmp_t bmp_load(const char* restrict path) 
 {
-    bmp_t bitmap;
-    bitmap.pixels = img_file_load(path, &bitmap.width, &bitmap.height, &bitmap.channels);
+    return bmp_load_scaled(path, 1);
+}
+
+bmp_t bmp_load_scaled(const char* restrict path, const unsigned int denom)
+{
+    bmp_t bitmap = {0};
+    bitmap.pixels = img_file_load_scaled(path, &bitmap.width, &bitmap.height, &bitmap.channels, denom);
+    bitmap.stride = bitmap.width * bitmap.channels;
     return bitmap;
 }
 
 void bmp_write(const char* restrict path, const bmp_t* restrict bitmap) 
 {
-    img_file_write(path, bitmap->pixels, bitmap->width, bitmap->height, bitmap->channels);
+    if (bitmap->stride != bitmap->width * bitmap->channels) {
+        bmp_t packed = bmp_copy(bitmap);
+        img_file_write(path, packed.pixels, packed.width, packed.height, packed.channels);
+        bmp_free(&packed);
+    } else img_file_write(path, bitmap->pixels, bitmap->width, bitmap->height, bitmap->channels);
 }
 
 void bmp_free(bmp_t* bitmap)
@@ -63,4 +112,3 @@ void bmp_free(bmp_t* bitmap)
         free(bitmap->pixels);
     }
 }
-
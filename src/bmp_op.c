@@ -1,328 +1,818 @@
 #include <imgtool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include "thread.h"
+#include "simd.h"
 
 /**************************************
  -> Bitmap algorithms and operations <-
  *************************************/
 
-#define px_aat(bitmap, x, y) (uint8_t*)(bitmap.pixels + ((bitmap.width * (y)) + (x)) * bitmap.channels)
-#define px_at(bitmap, x, y) (uint8_t*)(bitmap->pixels + ((bitmap->width * (y)) + (x)) * bitmap->channels)
-#define _lerpf(a, b, t) (float)((a) * (1.0 - (t)) + ((b) * (t)))
-#define _inverse_lerpf(a, b, val) (float)(((val) - (a)) / ((b) - (a)))
-#define _remapf(ia, ib, oa, ob, val) (float)(_lerpf(oa, ob, _inverse_lerpf(ia, ib, val)))
-#define ulerp(c1, c2, f) (uint8_t)(unsigned int)(int)(_lerpf((float)(int)c1, (float)(int)c2, f))
+#define px_aat(bitmap, x, y) (uint8_t*)(bitmap.pixels + (size_t)bitmap.stride * (y) + (x) * bitmap.channels)
+#define px_at(bitmap, x, y) (uint8_t*)(bitmap->pixels + (size_t)bitmap->stride * (y) + (x) * bitmap->channels)
+#define bmp_is_packed(bitmap) ((bitmap)->stride == (bitmap)->width * (bitmap)->channels)
 
-static void pxlerp(const uint8_t* restrict p1, const uint8_t* restrict p2, const float f, const unsigned int channels, uint8_t* out)
+/* shared argument block for the row band kernels run on the thread pool */
+typedef struct {
+    const bmp_t* src;
+    bmp_t* dst;
+    const void* data;
+    unsigned int param;
+} bmp_job_t;
+
+static void bmp_parallel(img_task_t task, const bmp_t* src, bmp_t* dst, const unsigned int rows, const void* data, const unsigned int param)
 {
-    for (unsigned int i = 0; i < channels; i++) {
-        out[i] = ulerp(p1[i], p2[i], f);
+    bmp_job_t job = {src, dst, data, param};
+    img_parallel_for(task, &job, rows, row_grain(dst->width * dst->channels));
+}
+
+static void pxswap(uint8_t* restrict p1, uint8_t* restrict p2, unsigned int size)
+{
+    uint8_t tmp[256];
+    while (size) {
+        const unsigned int n = size < sizeof(tmp) ? size : sizeof(tmp);
+        memcpy(tmp, p1, n);
+        memcpy(p1, p2, n);
+        memcpy(p2, tmp, n);
+        p1 += n;
+        p2 += n;
+        size -= n;
     }
 }
 
-static void pxaverage(const px_t* restrict in, uint8_t* out, const unsigned int channels)
+static void row_negative(uint8_t* restrict row, const unsigned int width, const unsigned int channels)
+{
+    img_negative_row(row, (size_t)width * channels);
+}
+
+static void row_black_and_white(uint8_t* restrict row, const unsigned int width, const unsigned int channels)
 {
-    unsigned int temp[channels];
-    for (unsigned int i = 0; i < channels; i++) {
-        temp[i] = 0;
-        for (unsigned int j = 0; j < 4; j++) {
-            temp[i] += (unsigned int)in[j][i];
+    img_black_and_white_row(row, width, channels);
+}
+
+/* transparency kernels widen the row to 4 channels in place, walking backwards */
+
+static void row_white_to_transparent(uint8_t* restrict row, const unsigned int width, const unsigned int channels)
+{
+    static const uint8_t white[4] = {255, 255, 255, 255};
+    for (unsigned int x = width; x-- > 0;) {
+        uint8_t px[4] = {0, 0, 0, 0};
+        if (memcmp(white, row + x * channels, channels)) {
+            memcpy(px, row + x * channels, channels);
+            px[3] = 255;
         }
-        out[i] = (uint8_t)(temp[i] / 4);
+        memcpy(row + x * 4, px, 4);
     }
 }
 
-static void bmp_min_max(const bmp_t* restrict bitmap, unsigned* x_min, unsigned* y_min, unsigned* x_max, unsigned* y_max)
+static void row_clear_to_transparent(uint8_t* restrict row, const unsigned int width, const unsigned int channels, const uint8_t sensibility)
 {
-    unsigned int min_x, min_y, max_x, max_y;
-    min_x = min_y = 100000;
-    max_x = max_y = 0;
+    for (unsigned int x = width; x-- > 0;) {
+        uint8_t px[4] = {0, 0, 0, 0};
+        const uint8_t* p = row + x * channels;
+        unsigned int t = 1;
+        for (unsigned int z = 0; z < channels; z++) {
+            if (p[z] <= sensibility) {
+                t = 0;
+                break;
+            }
+        }
+        if (!t) {
+            memcpy(px, p, channels);
+            px[3] = 255;
+        }
+        memcpy(row + x * 4, px, 4);
+    }
+}
 
-    const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            min_x = min_x * (x >= min_x) + x * (x < min_x);
-            min_y = min_y * (y >= min_y) + y * (y < min_y);
-            max_x = max_x * (x <= max_x) + x * (x > max_x);
-            max_y = max_y * (y <= max_y) + y * (y > max_y);
+static unsigned int row_pointwise(uint8_t* restrict row, const unsigned int width, unsigned int channels, const px_op_t* ops, const unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        switch (ops[i].op) {
+            case IMG_PX_NEGATIVE:
+                row_negative(row, width, channels);
+                break;
+            case IMG_PX_BLACK_AND_WHITE:
+                row_black_and_white(row, width, channels);
+                break;
+            case IMG_PX_WHITE_TO_TRANSPARENT:
+                row_white_to_transparent(row, width, channels);
+                channels = 4;
+                break;
+            case IMG_PX_CLEAR_TO_TRANSPARENT:
+                row_clear_to_transparent(row, width, channels, ops[i].param);
+                channels = 4;
+                break;
         }
     }
+    return channels;
+}
 
-    *x_min = min_x;
-    *y_min = min_y;
-    *x_max = max_x;
-    *y_max = max_y;
+unsigned int px_op_channels(const unsigned int channels, const px_op_t* ops, const unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (ops[i].op == IMG_PX_WHITE_TO_TRANSPARENT || ops[i].op == IMG_PX_CLEAR_TO_TRANSPARENT) {
+            return 4;
+        }
+    }
+    return channels;
 }
 
-bmp_t bmp_cut(const bmp_t* restrict bitmap)
+static void bmp_pointwise_rows(void* arg, const unsigned int begin, const unsigned int end)
 {
-    unsigned int x_min, y_min, x_max, y_max;
-    bmp_min_max(bitmap, &x_min, &y_min, &x_max, &y_max);
+    const bmp_job_t* job = arg;
+    const bmp_t* bitmap = job->src;
+    bmp_t* dst = job->dst;
+    for (unsigned int y = begin; y < end; y++) {
+        if (bitmap != dst) memcpy(px_at(dst, 0, y), px_at(bitmap, 0, y), bitmap->width * bitmap->channels);
+        row_pointwise(px_at(dst, 0, y), bitmap->width, bitmap->channels, job->data, job->param);
+    }
+}
 
-    bmp_t new_bitmap = bmp_new(x_max - x_min + 1, y_max - y_min + 1, bitmap->channels);
-    const unsigned int width = new_bitmap.width;
-    const unsigned int height = new_bitmap.height;
+void bmp_pointwise_inplace(bmp_t* bitmap, const px_op_t* ops, const unsigned int count)
+{
+    bmp_parallel(bmp_pointwise_rows, bitmap, bitmap, bitmap->height, ops, count);
+}
 
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            memcpy(px_aat(new_bitmap, x, y), px_at(bitmap, x + x_min, y + y_min), bitmap->channels);
-        }
-    }
+void bmp_pointwise_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const px_op_t* ops, const unsigned int count)
+{
+    bmp_reserve(dst, bitmap->width, bitmap->height, px_op_channels(bitmap->channels, ops, count));
+    bmp_parallel(bmp_pointwise_rows, bitmap, dst, bitmap->height, ops, count);
+}
+
+bmp_t bmp_pointwise(const bmp_t* restrict bitmap, const px_op_t* ops, const unsigned int count)
+{
+    bmp_t new_bitmap = {0};
+    bmp_pointwise_into(bitmap, &new_bitmap, ops, count);
     return new_bitmap;
 }
 
-bmp_t bmp_flip_horizontal(const bmp_t* restrict bitmap) 
+void bmp_negative_inplace(bmp_t* bitmap)
 {
-    const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
+    const px_op_t op = {IMG_PX_NEGATIVE, 0};
+    bmp_pointwise_inplace(bitmap, &op, 1);
+}
 
-    bmp_t new_bitmap = bmp_new(width, height, bitmap->channels);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            memcpy(px_aat(new_bitmap, x, y), px_at(bitmap, bitmap->width - 1 - x, y), bitmap->channels);
-        }
-    }
+bmp_t bmp_negative(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = bmp_copy(bitmap);
+    bmp_negative_inplace(&new_bitmap);
     return new_bitmap;
 }
 
-bmp_t bmp_flip_vertical(const bmp_t* restrict bitmap)
+void bmp_black_and_white_inplace(bmp_t* bitmap)
 {
-    const unsigned int width = bitmap->width;
+    const px_op_t op = {IMG_PX_BLACK_AND_WHITE, 0};
+    bmp_pointwise_inplace(bitmap, &op, 1);
+}
+
+bmp_t bmp_black_and_white(const bmp_t* restrict bitmap) 
+{
+    bmp_t new_bitmap = bmp_copy(bitmap);
+    bmp_black_and_white_inplace(&new_bitmap);
+    return new_bitmap;
+}
+
+void bmp_white_to_transparent_inplace(bmp_t* bitmap)
+{
+    const px_op_t op = {IMG_PX_WHITE_TO_TRANSPARENT, 0};
+    bmp_pointwise_inplace(bitmap, &op, 1);
+}
+
+void bmp_white_to_transparent_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    const px_op_t op = {IMG_PX_WHITE_TO_TRANSPARENT, 0};
+    bmp_pointwise_into(bitmap, dst, &op, 1);
+}
+
+bmp_t bmp_white_to_transparent(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_white_to_transparent_into(bitmap, &new_bitmap);
+    return new_bitmap;
+}
+
+void bmp_clear_to_transparent_inplace(bmp_t* bitmap, const uint8_t sensibility)
+{
+    const px_op_t op = {IMG_PX_CLEAR_TO_TRANSPARENT, sensibility};
+    bmp_pointwise_inplace(bitmap, &op, 1);
+}
+
+void bmp_clear_to_transparent_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const uint8_t sensibility)
+{
+    const px_op_t op = {IMG_PX_CLEAR_TO_TRANSPARENT, sensibility};
+    bmp_pointwise_into(bitmap, dst, &op, 1);
+}
+
+bmp_t bmp_clear_to_transparent(const bmp_t* restrict bitmap, const uint8_t sensibility)
+{
+    bmp_t new_bitmap = {0};
+    bmp_clear_to_transparent_into(bitmap, &new_bitmap, sensibility);
+    return new_bitmap;
+}
+
+static void bmp_copy_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const bmp_job_t* job = arg;
+    for (unsigned int y = begin; y < end; y++) {
+        memcpy(px_at(job->dst, 0, y), px_at(job->src, 0, y), job->src->width * job->src->channels);
+    }
+}
+
+/* empty pixels match the top left one, only by alpha when that one is transparent */
+static void bmp_trim_pattern(const bmp_t* restrict bitmap, uint8_t* pattern, uint8_t* mask)
+{
+    const unsigned int channels = bitmap->channels;
+    const int alpha = (channels == 2 || channels == 4) && !bitmap->pixels[channels - 1];
+    for (unsigned int i = 0; i < 48; i++) {
+        const unsigned int c = i % channels;
+        pattern[i] = bitmap->pixels[c];
+        mask[i] = !alpha || c == channels - 1 ? 0xFF : 0;
+    }
+}
+
+bmp_t bmp_trim_view(const bmp_t* restrict bitmap)
+{
+    uint8_t pattern[48], mask[48];
+    bmp_trim_pattern(bitmap, pattern, mask);
+
     const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, bitmap->channels);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            memcpy(px_aat(new_bitmap, x, y), px_at(bitmap, x, bitmap->height - 1 - y), bitmap->channels);
-        }
+    const unsigned int channels = bitmap->channels;
+    const size_t size = (size_t)bitmap->width * channels;
+
+    unsigned int top = 0, bottom = height;
+    while (top < height && img_find_row(px_at(bitmap, 0, top), 0, size, pattern, mask) == size) {
+        ++top;
+    }
+    if (top == height) {
+        return bmp_view(bitmap, 0, 0, 1, 1);
     }
+    while (img_find_row(px_at(bitmap, 0, bottom - 1), 0, size, pattern, mask) == size) {
+        --bottom;
+    }
+
+    /* each row only narrows what is left outside the current bounds */
+    size_t left = size, right = 0;
+    for (unsigned int y = top; y < bottom && (left || right < size); y++) {
+        const uint8_t* row = px_at(bitmap, 0, y);
+        left = img_find_row(row, 0, left, pattern, mask);
+        right = img_find_row_last(row, right, size, pattern, mask);
+    }
+
+    left /= channels;
+    right = (right + channels - 1) / channels;
+    return bmp_view(bitmap, left, top, right - left, bottom - top);
+}
+
+void bmp_cut_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    const bmp_t view = bmp_trim_view(bitmap);
+    bmp_reserve(dst, view.width, view.height, view.channels);
+    bmp_parallel(bmp_copy_rows, &view, dst, view.height, NULL, 0);
+}
+
+bmp_t bmp_cut(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_cut_into(bitmap, &new_bitmap);
     return new_bitmap;
 }
 
-bmp_t bmp_greyscale(const bmp_t* restrict bitmap)
+static void bmp_flip_horizontal_rows(void* arg, const unsigned int begin, const unsigned int end)
 {
+    bmp_t* bitmap = ((const bmp_job_t*)arg)->dst;
     const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, 1);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            uint8_t* p = px_at(bitmap, x, y);
-            int m = 0;
-            int div = bitmap->channels * (bitmap->channels <= 3) + 3 * (bitmap->channels > 3);
-            for (int j = 0; j < div; j++) {
-                m += (int)p[j];
-            }
-            m /= div;
-            memset(px_aat(new_bitmap, x, y), m, 1);
+    const unsigned int channels = bitmap->channels;
+    for (unsigned int y = begin; y < end; y++) {
+        for (unsigned int x = 0; x < width / 2; x++) {
+            pxswap(px_at(bitmap, x, y), px_at(bitmap, width - 1 - x, y), channels);
         }
     }
-    return new_bitmap;
 }
 
-bmp_t bmp_black_and_white(const bmp_t* restrict bitmap) 
+void bmp_flip_horizontal_inplace(bmp_t* bitmap)
 {
-    const unsigned int width = bitmap->width;
+    bmp_parallel(bmp_flip_horizontal_rows, bitmap, bitmap, bitmap->height, NULL, 0);
+}
+
+static void bmp_flip_vertical_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    bmp_t* bitmap = ((const bmp_job_t*)arg)->dst;
     const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, bitmap->channels);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            uint8_t* p = px_at(bitmap, x, y);
-            int m = 0;
-            for (unsigned int j = 0; j < bitmap->channels; j++) {
-                m += (unsigned int)p[j];
-            }
-            m /= bitmap->channels;
-            memset(px_aat(new_bitmap, x, y), m, bitmap->channels);
-        }
+    const unsigned int size = bitmap->width * bitmap->channels;
+    for (unsigned int y = begin; y < end; y++) {
+        pxswap(px_at(bitmap, 0, y), px_at(bitmap, 0, height - 1 - y), size);
     }
-    return new_bitmap;
 }
 
-bmp_t bmp_rotate(const bmp_t* restrict bitmap)
+void bmp_flip_vertical_inplace(bmp_t* bitmap)
 {
+    bmp_parallel(bmp_flip_vertical_rows, bitmap, bitmap, bitmap->height / 2, NULL, 0);
+}
+
+/* each band row y swaps with row height - 1 - y, the middle row of odd heights swaps with itself */
+static void bmp_rotate_180_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    bmp_t* bitmap = ((const bmp_job_t*)arg)->dst;
     const unsigned int width = bitmap->width;
     const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, bitmap->channels);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            memcpy(px_aat(new_bitmap, x, y), px_at(bitmap, y, x), bitmap->channels);
+    const unsigned int channels = bitmap->channels;
+    for (unsigned int y = begin; y < end; y++) {
+        const unsigned int span = y == height - 1 - y ? width / 2 : width;
+        for (unsigned int x = 0; x < span; x++) {
+            pxswap(px_at(bitmap, x, y), px_at(bitmap, width - 1 - x, height - 1 - y), channels);
         }
     }
+}
+
+void bmp_rotate_180_inplace(bmp_t* bitmap)
+{
+    bmp_parallel(bmp_rotate_180_rows, bitmap, bitmap, (bitmap->height + 1) / 2, NULL, 0);
+}
+
+bmp_t bmp_flip_horizontal(const bmp_t* restrict bitmap) 
+{
+    bmp_t new_bitmap = bmp_copy(bitmap);
+    bmp_flip_horizontal_inplace(&new_bitmap);
     return new_bitmap;
 }
 
-bmp_t bmp_scale(const bmp_t* restrict bitmap)
+bmp_t bmp_flip_vertical(const bmp_t* restrict bitmap)
 {
-    const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width * 2, height * 2, bitmap->channels);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            unsigned int xx = x * 2, yy = y * 2;
-            uint8_t* p = px_at(bitmap, x, y);
-            memcpy(px_aat(new_bitmap, xx, yy), p, bitmap->channels);
-            memcpy(px_aat(new_bitmap, xx + 1, yy), p, bitmap->channels);
-            memcpy(px_aat(new_bitmap, xx, yy + 1), p, bitmap->channels);
-            memcpy(px_aat(new_bitmap, xx + 1, yy + 1), p, bitmap->channels);
-        }
+    bmp_t new_bitmap = bmp_copy(bitmap);
+    bmp_flip_vertical_inplace(&new_bitmap);
+    return new_bitmap;
+}
+
+bmp_t bmp_rotate_180(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = bmp_copy(bitmap);
+    bmp_rotate_180_inplace(&new_bitmap);
+    return new_bitmap;
+}
+
+static void bmp_greyscale_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const bmp_t* bitmap = ((const bmp_job_t*)arg)->src;
+    bmp_t* dst = ((const bmp_job_t*)arg)->dst;
+    for (unsigned int y = begin; y < end; y++) {
+        img_convert_row(px_at(bitmap, 0, y), px_at(dst, 0, y), bitmap->width, bitmap->channels, 1);
     }
+}
+
+void bmp_greyscale_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_reserve(dst, bitmap->width, bitmap->height, 1);
+    bmp_parallel(bmp_greyscale_rows, bitmap, dst, bitmap->height, NULL, 0);
+}
+
+bmp_t bmp_greyscale(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_greyscale_into(bitmap, &new_bitmap);
     return new_bitmap;
 }
 
-bmp_t bmp_white_to_transparent(const bmp_t* restrict bitmap)
+/* dst(x, y) reads the source at column y and row x, a quarter turn clockwise
+ * reads the rows bottom up, counter clockwise reads the columns right to left
+ * and the transverse does both */
+#define ROTATE_FLIP_ROWS 1
+#define ROTATE_FLIP_COLUMNS 2
+#define ROTATE_TILE 64
+
+static inline const uint8_t* rotate_src(const bmp_t* bitmap, const unsigned int mode, const unsigned int x, const unsigned int y)
 {
-    static uint8_t white[4] = {255, 255, 255, 255};
-    static uint8_t transparent[4] = {0, 0, 0, 0};
+    const unsigned int sx = mode & ROTATE_FLIP_COLUMNS ? bitmap->width - 1 - y : y;
+    const unsigned int sy = mode & ROTATE_FLIP_ROWS ? bitmap->height - 1 - x : x;
+    return px_at(bitmap, sx, sy);
+}
 
-    const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, 4);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            if (!memcmp(&white, px_at(bitmap, x, y), bitmap->channels)) {
-                memcpy(px_aat(new_bitmap, x, y), &transparent, new_bitmap.channels);
-            } else {
-                memcpy(px_aat(new_bitmap, x, y), px_at(bitmap, x, y), bitmap->channels);
-                *(px_aat(new_bitmap, x, y) + 3) = 255;
+/* blocks are n x n pixels, s holds the source rows in dst column order and d
+ * the dst rows in source column order, so the flips are only pointer order */
+static inline void rotate_block_ptrs(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x, const unsigned int y, const unsigned int n, const uint8_t** s, uint8_t** d)
+{
+    const unsigned int first = mode & ROTATE_FLIP_COLUMNS ? y + n - 1 : y;
+    for (unsigned int k = 0; k < n; k++) {
+        s[k] = rotate_src(bitmap, mode, x + k, first);
+        d[k] = px_at(dst, x, mode & ROTATE_FLIP_COLUMNS ? y + n - 1 - k : y + k);
+    }
+}
+
+#if defined(IMG_SIMD_SSSE3)
+
+IMG_TARGET_SSSE3
+static void ssse3_rotate_blocks(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x0, const unsigned int x1, const unsigned int y0, const unsigned int y1)
+{
+    const uint8_t* s[8];
+    uint8_t* d[8];
+    if (dst->channels == 1) {
+        for (unsigned int y = y0; y < y1; y += 8) {
+            for (unsigned int x = x0; x < x1; x += 8) {
+                rotate_block_ptrs(bitmap, dst, mode, x, y, 8, s, d);
+                __m128i a[8], b[4], c[4];
+                for (int k = 0; k < 8; k++) {
+                    a[k] = _mm_loadl_epi64((const __m128i*)s[k]);
+                }
+                for (int k = 0; k < 4; k++) {
+                    b[k] = _mm_unpacklo_epi8(a[k * 2], a[k * 2 + 1]);
+                }
+                c[0] = _mm_unpacklo_epi16(b[0], b[1]), c[1] = _mm_unpackhi_epi16(b[0], b[1]);
+                c[2] = _mm_unpacklo_epi16(b[2], b[3]), c[3] = _mm_unpackhi_epi16(b[2], b[3]);
+                const __m128i rows[4] = {
+                    _mm_unpacklo_epi32(c[0], c[2]), _mm_unpackhi_epi32(c[0], c[2]),
+                    _mm_unpacklo_epi32(c[1], c[3]), _mm_unpackhi_epi32(c[1], c[3])
+                };
+                for (int k = 0; k < 4; k++) {
+                    _mm_storel_epi64((__m128i*)d[k * 2], rows[k]);
+                    _mm_storel_epi64((__m128i*)d[k * 2 + 1], _mm_srli_si128(rows[k], 8));
+                }
             }
         }
+        return;
+    }
+
+    for (unsigned int y = y0; y < y1; y += 4) {
+        for (unsigned int x = x0; x < x1; x += 4) {
+            rotate_block_ptrs(bitmap, dst, mode, x, y, 4, s, d);
+            const __m128i r0 = _mm_loadu_si128((const __m128i*)s[0]), r1 = _mm_loadu_si128((const __m128i*)s[1]);
+            const __m128i r2 = _mm_loadu_si128((const __m128i*)s[2]), r3 = _mm_loadu_si128((const __m128i*)s[3]);
+            const __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+            const __m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+            _mm_storeu_si128((__m128i*)d[0], _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128((__m128i*)d[1], _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128((__m128i*)d[2], _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128((__m128i*)d[3], _mm_unpackhi_epi64(t2, t3));
+        }
     }
-    return new_bitmap;
 }
 
-bmp_t bmp_clear_to_transparent(const bmp_t* restrict bitmap, const uint8_t sensibility)
+static int simd_rotate_blocks(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x0, const unsigned int x1, const unsigned int y0, const unsigned int y1)
 {
-    static uint8_t transparent[4] = {0, 0, 0, 0};
+    if (!img_simd_ssse3()) return 0;
+    ssse3_rotate_blocks(bitmap, dst, mode, x0, x1, y0, y1);
+    return 1;
+}
 
-    const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, 4);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            unsigned int t = 1;
-            for (unsigned int z = 0; z < bitmap->channels; z++) {
-                if (*(px_at(bitmap, x, y) + z) <= sensibility) {
-                    t = 0;
-                    break;
+#elif defined(IMG_SIMD_NEON)
+
+static int simd_rotate_blocks(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x0, const unsigned int x1, const unsigned int y0, const unsigned int y1)
+{
+    const uint8_t* s[8];
+    uint8_t* d[8];
+    if (dst->channels == 1) {
+        for (unsigned int y = y0; y < y1; y += 8) {
+            for (unsigned int x = x0; x < x1; x += 8) {
+                rotate_block_ptrs(bitmap, dst, mode, x, y, 8, s, d);
+                const uint8x8x2_t t0 = vtrn_u8(vld1_u8(s[0]), vld1_u8(s[1])), t1 = vtrn_u8(vld1_u8(s[2]), vld1_u8(s[3]));
+                const uint8x8x2_t t2 = vtrn_u8(vld1_u8(s[4]), vld1_u8(s[5])), t3 = vtrn_u8(vld1_u8(s[6]), vld1_u8(s[7]));
+                const uint16x4x2_t u0 = vtrn_u16(vreinterpret_u16_u8(t0.val[0]), vreinterpret_u16_u8(t1.val[0]));
+                const uint16x4x2_t u1 = vtrn_u16(vreinterpret_u16_u8(t0.val[1]), vreinterpret_u16_u8(t1.val[1]));
+                const uint16x4x2_t u2 = vtrn_u16(vreinterpret_u16_u8(t2.val[0]), vreinterpret_u16_u8(t3.val[0]));
+                const uint16x4x2_t u3 = vtrn_u16(vreinterpret_u16_u8(t2.val[1]), vreinterpret_u16_u8(t3.val[1]));
+                const uint32x2x2_t v[4] = {
+                    vtrn_u32(vreinterpret_u32_u16(u0.val[0]), vreinterpret_u32_u16(u2.val[0])),
+                    vtrn_u32(vreinterpret_u32_u16(u1.val[0]), vreinterpret_u32_u16(u3.val[0])),
+                    vtrn_u32(vreinterpret_u32_u16(u0.val[1]), vreinterpret_u32_u16(u2.val[1])),
+                    vtrn_u32(vreinterpret_u32_u16(u1.val[1]), vreinterpret_u32_u16(u3.val[1]))
+                };
+                for (int k = 0; k < 4; k++) {
+                    vst1_u8(d[k], vreinterpret_u8_u32(v[k].val[0]));
+                    vst1_u8(d[k + 4], vreinterpret_u8_u32(v[k].val[1]));
                 }
             }
-            if (t) memcpy(px_aat(new_bitmap, x, y), &transparent, new_bitmap.channels);
-            else {
-                memcpy(px_aat(new_bitmap, x, y), px_at(bitmap, x, y), bitmap->channels);
-                *(px_aat(new_bitmap, x, y) + 3) = 255;
+        }
+        return 1;
+    }
+
+    for (unsigned int y = y0; y < y1; y += 4) {
+        for (unsigned int x = x0; x < x1; x += 4) {
+            rotate_block_ptrs(bitmap, dst, mode, x, y, 4, s, d);
+            const uint32x4x2_t t0 = vtrnq_u32(vreinterpretq_u32_u8(vld1q_u8(s[0])), vreinterpretq_u32_u8(vld1q_u8(s[1])));
+            const uint32x4x2_t t1 = vtrnq_u32(vreinterpretq_u32_u8(vld1q_u8(s[2])), vreinterpretq_u32_u8(vld1q_u8(s[3])));
+            vst1q_u8(d[0], vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(t0.val[0]), vget_low_u32(t1.val[0]))));
+            vst1q_u8(d[1], vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(t0.val[1]), vget_low_u32(t1.val[1]))));
+            vst1q_u8(d[2], vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(t0.val[0]), vget_high_u32(t1.val[0]))));
+            vst1q_u8(d[3], vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(t0.val[1]), vget_high_u32(t1.val[1]))));
+        }
+    }
+    return 1;
+}
+
+#else
+
+static int simd_rotate_blocks(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x0, const unsigned int x1, const unsigned int y0, const unsigned int y1)
+{
+    (void)bitmap, (void)dst, (void)mode, (void)x0, (void)x1, (void)y0, (void)y1;
+    return 0;
+}
+
+#endif
+
+/* walks each source row once per dst column, the writes stay inside the tile */
+static void rotate_rect(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x0, const unsigned int x1, const unsigned int y0, const unsigned int y1)
+{
+    if (y0 >= y1) return;
+    const unsigned int channels = dst->channels;
+    const long step = mode & ROTATE_FLIP_COLUMNS ? -(long)channels : (long)channels;
+    for (unsigned int x = x0; x < x1; x++) {
+        const uint8_t* s = rotate_src(bitmap, mode, x, y0);
+        uint8_t* d = px_at(dst, x, y0);
+        for (unsigned int y = y0; y < y1; y++, s += step, d += dst->stride) {
+            switch (channels) {
+                case 4: d[3] = s[3]; /* fallthrough */
+                case 3: d[2] = s[2]; /* fallthrough */
+                case 2: d[1] = s[1]; /* fallthrough */
+                default: d[0] = s[0];
             }
         }
     }
+}
+
+static void rotate_tile(const bmp_t* bitmap, bmp_t* dst, const unsigned int mode, const unsigned int x0, const unsigned int x1, const unsigned int y0, const unsigned int y1)
+{
+    const unsigned int n = dst->channels == 1 ? 8 : dst->channels == 4 ? 4 : 1;
+    unsigned int xb = x0 + (x1 - x0) / n * n, yb = y0 + (y1 - y0) / n * n;
+    if (n == 1 || !simd_rotate_blocks(bitmap, dst, mode, x0, xb, y0, yb)) xb = x0;
+    rotate_rect(bitmap, dst, mode, xb, x1, y0, yb);
+    rotate_rect(bitmap, dst, mode, x0, x1, yb, y1);
+}
+
+/* each band is a row of tiles */
+static void bmp_rotate_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const bmp_t* bitmap = ((const bmp_job_t*)arg)->src;
+    bmp_t* dst = ((const bmp_job_t*)arg)->dst;
+    const unsigned int mode = ((const bmp_job_t*)arg)->param;
+    for (unsigned int t = begin; t < end; t++) {
+        const unsigned int y0 = t * ROTATE_TILE;
+        const unsigned int y1 = y0 + ROTATE_TILE < dst->height ? y0 + ROTATE_TILE : dst->height;
+        for (unsigned int x0 = 0; x0 < dst->width; x0 += ROTATE_TILE) {
+            rotate_tile(bitmap, dst, mode, x0, x0 + ROTATE_TILE < dst->width ? x0 + ROTATE_TILE : dst->width, y0, y1);
+        }
+    }
+}
+
+static void bmp_quarter_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const unsigned int mode)
+{
+    bmp_reserve(dst, bitmap->height, bitmap->width, bitmap->channels);
+    bmp_job_t job = {bitmap, dst, NULL, mode};
+    img_parallel_for(bmp_rotate_rows, &job, (dst->height + ROTATE_TILE - 1) / ROTATE_TILE, 1);
+}
+
+void bmp_rotate_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_quarter_into(bitmap, dst, ROTATE_FLIP_ROWS);
+}
+
+void bmp_rotate_270_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_quarter_into(bitmap, dst, ROTATE_FLIP_COLUMNS);
+}
+
+void bmp_transpose_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_quarter_into(bitmap, dst, 0);
+}
+
+void bmp_transverse_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_quarter_into(bitmap, dst, ROTATE_FLIP_ROWS | ROTATE_FLIP_COLUMNS);
+}
+
+bmp_t bmp_rotate(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_rotate_into(bitmap, &new_bitmap);
     return new_bitmap;
 }
 
-bmp_t bmp_reduce(const bmp_t* restrict bitmap)
+bmp_t bmp_rotate_270(const bmp_t* restrict bitmap)
 {
-    bmp_t new_bitmap = bmp_new(bitmap->width / 2, bitmap->height / 2, bitmap->channels);
-    const unsigned int width = new_bitmap.width;
-    const unsigned int height = new_bitmap.height;
-    for (unsigned int y = 0; y < height; y++) {
+    bmp_t new_bitmap = {0};
+    bmp_rotate_270_into(bitmap, &new_bitmap);
+    return new_bitmap;
+}
+
+bmp_t bmp_transpose(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_transpose_into(bitmap, &new_bitmap);
+    return new_bitmap;
+}
+
+bmp_t bmp_transverse(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_transverse_into(bitmap, &new_bitmap);
+    return new_bitmap;
+}
+
+static void bmp_scale_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const bmp_t* bitmap = ((const bmp_job_t*)arg)->src;
+    bmp_t* dst = ((const bmp_job_t*)arg)->dst;
+    const unsigned int width = bitmap->width;
+    for (unsigned int y = begin; y < end; y++) {
         for (unsigned int x = 0; x < width; x++) {
-            px_t p[4];
-            uint8_t cpy[bitmap->channels];
-            p[0] = px_at(bitmap, x * 2, y * 2);
-            p[1] = px_at(bitmap, x * 2 + 1, y * 2);
-            p[2] = px_at(bitmap, x * 2, y * 2 + 1);
-            p[3] = px_at(bitmap, x * 2 + 1, y * 2 + 1);
-            pxaverage(&p[0], &cpy[0], bitmap->channels);
-            memcpy(px_aat(new_bitmap, x, y), &cpy[0], bitmap->channels);
+            unsigned int xx = x * 2, yy = y * 2;
+            uint8_t* p = px_at(bitmap, x, y);
+            memcpy(px_at(dst, xx, yy), p, bitmap->channels);
+            memcpy(px_at(dst, xx + 1, yy), p, bitmap->channels);
+            memcpy(px_at(dst, xx, yy + 1), p, bitmap->channels);
+            memcpy(px_at(dst, xx + 1, yy + 1), p, bitmap->channels);
         }
     }
+}
+
+void bmp_scale_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_reserve(dst, bitmap->width * 2, bitmap->height * 2, bitmap->channels);
+    bmp_parallel(bmp_scale_rows, bitmap, dst, bitmap->height, NULL, 0);
+}
+
+bmp_t bmp_scale(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_scale_into(bitmap, &new_bitmap);
+    return new_bitmap;
+}
+
+static void bmp_reduce_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const bmp_t* bitmap = ((const bmp_job_t*)arg)->src;
+    bmp_t* dst = ((const bmp_job_t*)arg)->dst;
+    for (unsigned int y = begin; y < end; y++) {
+        img_reduce_row(px_at(bitmap, 0, y * 2), px_at(bitmap, 0, y * 2 + 1), px_at(dst, 0, y), dst->width, dst->channels);
+    }
+}
+
+void bmp_reduce_into(const bmp_t* restrict bitmap, bmp_t* restrict dst)
+{
+    bmp_reserve(dst, bitmap->width / 2, bitmap->height / 2, bitmap->channels);
+    bmp_parallel(bmp_reduce_rows, bitmap, dst, dst->height, NULL, 0);
+}
+
+bmp_t bmp_reduce(const bmp_t* restrict bitmap)
+{
+    bmp_t new_bitmap = {0};
+    bmp_reduce_into(bitmap, &new_bitmap);
     return new_bitmap;
 }
 
 bmp_t bmp_jcompress(const bmp_t* restrict bitmap, const unsigned int quality)
 {
     const unsigned int q = (quality > 100) ? quality : 100;
+    bmp_t packed = bmp_is_packed(bitmap) ? *bitmap : bmp_copy(bitmap);
     bmp_t b;
     b.width = bitmap->width;
     b.height = bitmap->height;
     b.channels = 3;
-    b.pixels = img_jcompress(bitmap->pixels, bitmap->width, bitmap->height, bitmap->channels, q);
+    b.stride = b.width * b.channels;
+    b.pixels = img_jcompress(packed.pixels, bitmap->width, bitmap->height, bitmap->channels, q);
+    if (packed.pixels != bitmap->pixels) bmp_free(&packed);
     return b;
 }
 
+static void bmp_transform_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const bmp_t* bitmap = ((const bmp_job_t*)arg)->src;
+    bmp_t* dst = ((const bmp_job_t*)arg)->dst;
+    for (unsigned int y = begin; y < end; y++) {
+        img_convert_row(px_at(bitmap, 0, y), px_at(dst, 0, y), bitmap->width, bitmap->channels, dst->channels);
+    }
+}
+
 bmp_t bmp_transform(const bmp_t* restrict bitmap, const unsigned int channels)
 {
-    bmp_t ret;
-    ret.width = bitmap->width;
-    ret.height = bitmap->height;
-    ret.channels = channels;
-    ret.pixels = img_transform_buffer(bitmap->pixels, bitmap->width, bitmap->height, bitmap->channels, channels);
+    bmp_t ret = {0};
+    if (channels < IMG_G || channels > IMG_RGBA) return ret;
+    bmp_reserve(&ret, bitmap->width, bitmap->height, channels);
+    bmp_parallel(bmp_transform_rows, bitmap, &ret, bitmap->height, NULL, 0);
     return ret;
 }
 
-bmp_t bmp_negative(const bmp_t* restrict bitmap)
+/* bilinear sample positions, byte offsets of both neighbours and an 8 bit fraction */
+typedef struct {
+    unsigned int *x0, *x1, *y0;
+    uint16_t *fx, *fy;
+} bmp_lerp_t;
+
+static void bmp_lerp_axis(unsigned int* p0, unsigned int* p1, uint16_t* frac, const unsigned int in, const unsigned int out, const unsigned int step)
 {
-    const unsigned int width = bitmap->width;
-    const unsigned int height = bitmap->height;
-    bmp_t new_bitmap = bmp_new(width, height, bitmap->channels);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int z = 0; z < bitmap->channels; z++) {
-                *(px_aat(new_bitmap, x, y) + z) = 255 - *(px_at(bitmap, x, y) + z);
-            }
-        }
+    for (unsigned int i = 0; i < out; i++) {
+        const unsigned long long pos = ((unsigned long long)i * in << 8) / out;
+        const unsigned int p = (unsigned int)(pos >> 8);
+        const int last = p + 1 >= in;
+        p0[i] = p * step;
+        if (p1) p1[i] = (last ? p : p + 1) * step;
+        frac[i] = last ? 0 : (uint16_t)(pos & 255);
     }
-    return new_bitmap;
 }
 
-bmp_t bmp_resize_width(const bmp_t* restrict bmp, const unsigned int target_width)
+/* horizontally resampled rows are kept at 16 bits in a two row ring, slot is row parity */
+static const uint16_t* bmp_lerp_row(const bmp_t* bmp, const bmp_lerp_t* lerp, uint16_t* ring, unsigned int* cached, const unsigned int y, const unsigned int size)
 {
-    const unsigned int height = bmp->height;
-    bmp_t new_bmp = bmp_new(target_width, height, bmp->channels);
-    
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < target_width; x++) {
-            const float dx = _remapf(0.0f, (float)target_width, 0.0f, (float)bmp->width, (float)x);
-            const float dif = dx - (float)((unsigned int)dx);
-            const unsigned int xx = dx - dif;
-
-            if (xx + 1 < target_width) {
-                uint8_t out[bmp->channels];
-                pxlerp(px_at(bmp, xx, y), px_at(bmp, xx + 1, y), dif, bmp->channels, out);
-                memcpy(px_aat(new_bmp, x, y), out, bmp->channels);
-            }
-            else memcpy(px_aat(new_bmp, x, y), px_at(bmp, xx, y), bmp->channels);
+    uint16_t* row = ring + (y & 1) * (size_t)size;
+    if (cached[y & 1] == y) return row;
+    cached[y & 1] = y;
+
+    const uint8_t* src = px_at(bmp, 0, y);
+    const unsigned int channels = bmp->channels;
+    for (unsigned int x = 0, i = 0; i < size; x++) {
+        const uint8_t* a = src + lerp->x0[x];
+        const uint8_t* b = src + lerp->x1[x];
+        const unsigned int f = lerp->fx[x];
+        for (unsigned int c = 0; c < channels; c++, i++) {
+            row[i] = (uint16_t)(a[c] * (256 - f) + b[c] * f);
         }
     }
-    return new_bmp;
+    return row;
 }
 
-bmp_t bmp_resize_height(const bmp_t* restrict bmp, const unsigned int target_height)
+static void bmp_lerp_rows(void* arg, const unsigned int begin, const unsigned int end)
 {
-    const unsigned int width = bmp->width;
-    bmp_t new_bmp = bmp_new(width, target_height, bmp->channels);
-    
-    for (unsigned int y = 0; y < target_height; y++) {
-        
-        const float dy = _remapf(0.0f, (float)target_height, 0.0f, (float)bmp->height, (float)y);
-        const float dif = dy - (float)((unsigned int)dy);
-        const unsigned int yy = dy - dif;
-        
-        for (unsigned int x = 0; x < width; x++) {
-            if (yy + 1 < target_height) {
-                unsigned char out[bmp->channels];
-                pxlerp(px_at(bmp, x, yy), px_at(bmp, x, yy + 1), dif, bmp->channels, out);
-                memcpy(px_aat(new_bmp, x, y), out, bmp->channels);
-            }
-            else memcpy(px_aat(new_bmp, x, y), px_at(bmp, x, yy), bmp->channels);
+    const bmp_job_t* job = arg;
+    const bmp_t* bmp = job->src;
+    bmp_t* dst = job->dst;
+    const bmp_lerp_t* lerp = job->data;
+    const unsigned int size = dst->width * dst->channels;
+    unsigned int cached[2] = {bmp->height, bmp->height};
+    uint16_t* ring = malloc(2 * (size_t)size * sizeof(uint16_t));
+    if (!ring) {
+        fprintf(stderr, "imgtool could not allocate memory for bilinear scaling\n");
+        return;
+    }
+
+    for (unsigned int y = begin; y < end; y++) {
+        const unsigned int y0 = lerp->y0[y];
+        const unsigned int fy = lerp->fy[y];
+        const uint16_t* r0 = bmp_lerp_row(bmp, lerp, ring, cached, y0, size);
+        const uint16_t* r1 = fy ? bmp_lerp_row(bmp, lerp, ring, cached, y0 + 1, size) : r0;
+        uint8_t* out = px_at(dst, 0, y);
+        for (unsigned int i = 0; i < size; i++) {
+            out[i] = (uint8_t)((r0[i] * (256 - fy) + r1[i] * fy + 32768) >> 16);
         }
     }
-    return new_bmp;
+    free(ring);
 }
 
-bmp_t bmp_scale_lerp(const bmp_t* restrict bmp, const float f)
+/* single pass bilinear scale, every source row is resampled at most once per band */
+static void bmp_lerp_into(const bmp_t* restrict bmp, bmp_t* restrict dst, const unsigned int width, const unsigned int height)
+{
+    bmp_lerp_t lerp;
+    lerp.x0 = malloc(2 * (size_t)width * sizeof(unsigned int));
+    lerp.y0 = malloc((size_t)height * sizeof(unsigned int));
+    lerp.fx = malloc(((size_t)width + height) * sizeof(uint16_t));
+    if (!lerp.x0 || !lerp.y0 || !lerp.fx) {
+        fprintf(stderr, "imgtool could not allocate memory for bilinear scaling\n");
+    } else {
+        lerp.x1 = lerp.x0 + width;
+        lerp.fy = lerp.fx + width;
+        bmp_lerp_axis(lerp.x0, lerp.x1, lerp.fx, bmp->width, width, bmp->channels);
+        bmp_lerp_axis(lerp.y0, NULL, lerp.fy, bmp->height, height, 1);
+        bmp_reserve(dst, width, height, bmp->channels);
+        bmp_parallel(bmp_lerp_rows, bmp, dst, height, &lerp, 0);
+    }
+    free(lerp.x0);
+    free(lerp.y0);
+    free(lerp.fx);
+}
+
+void bmp_resize_width_into(const bmp_t* restrict bmp, bmp_t* restrict dst, const unsigned int target_width)
+{
+    bmp_lerp_into(bmp, dst, target_width, bmp->height);
+}
+
+bmp_t bmp_resize_width(const bmp_t* restrict bmp, const unsigned int target_width)
+{
+    bmp_t new_bitmap = {0};
+    bmp_resize_width_into(bmp, &new_bitmap, target_width);
+    return new_bitmap;
+}
+
+void bmp_resize_height_into(const bmp_t* restrict bmp, bmp_t* restrict dst, const unsigned int target_height)
+{
+    bmp_lerp_into(bmp, dst, bmp->width, target_height);
+}
+
+bmp_t bmp_resize_height(const bmp_t* restrict bmp, const unsigned int target_height)
+{
+    bmp_t new_bitmap = {0};
+    bmp_resize_height_into(bmp, &new_bitmap, target_height);
+    return new_bitmap;
+}
+
+void bmp_scale_lerp_into(const bmp_t* restrict bmp, bmp_t* restrict dst, const float f)
 {
     unsigned int target_width = (unsigned int)((float)bmp->width * f);
     unsigned int target_height = (unsigned int)((float)bmp->height * f);
-    bmp_t temp = bmp_resize_width(bmp, target_width);
-    bmp_t ret = bmp_resize_height(&temp, target_height);
-    bmp_free(&temp);
-    return ret;
+    bmp_lerp_into(bmp, dst, target_width, target_height);
 }
 
+bmp_t bmp_scale_lerp(const bmp_t* restrict bmp, const float f)
+{
+    bmp_t new_bitmap = {0};
+    bmp_scale_lerp_into(bmp, &new_bitmap, f);
+    return new_bitmap;
+}
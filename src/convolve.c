@@ -0,0 +1,401 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "thread.h"
+#include "simd.h"
+
+/*****************
+ -> Convolution <-
+ ****************/
+
+#define CONV_SHIFT 14
+
+/* a pass adds up weighted bytes of taps that are a row and a byte offset,
+ * the 32 bit sum is shifted back from fixed point and biased */
+typedef struct {
+    unsigned int count;
+    unsigned int* row;
+    size_t* offset;
+    int16_t* weight;
+    unsigned int shift;
+    int bias;
+} conv_pass_t;
+
+typedef enum {
+    CONV_2D,
+    CONV_ROWS_FIRST,
+    CONV_COLUMNS_FIRST
+} conv_mode_enum;
+
+/* rank one kernels run as a row and a column pass, the one with a single sign
+ * goes first and normalized so its 8 bit output does not clip */
+typedef struct {
+    const bmp_t* src;
+    bmp_t* dst;
+    conv_pass_t pass[2];
+    unsigned int width, height;
+    conv_mode_enum mode;
+} conv_job_t;
+
+static const int conv_sharpen[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
+static const int conv_edge[9] = {-1, -1, -1, -1, 8, -1, -1, -1, -1};
+static const int conv_emboss[9] = {-2, -1, 0, -1, 1, 1, 0, 1, 2};
+static const int conv_unsharp[25] = {
+    -1, -4, -6, -4, -1,
+    -4, -16, -24, -16, -4,
+    -6, -24, 476, -24, -6,
+    -4, -16, -24, -16, -4,
+    -1, -4, -6, -4, -1
+};
+
+static void conv_taps_scalar(const uint8_t* const* taps, const int16_t* weights, const unsigned int count, uint8_t* out, const size_t begin, const size_t end, const unsigned int shift, const int bias)
+{
+    const int32_t round = shift ? 1 << (shift - 1) : 0;
+    for (size_t i = begin; i < end; i++) {
+        int32_t sum = round;
+        for (unsigned int t = 0; t < count; t++) {
+            sum += weights[t] * taps[t][i];
+        }
+        const int32_t v = (sum >> shift) + bias;
+        out[i] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+}
+
+#if defined(IMG_SIMD_SSSE3)
+
+/* taps come in pairs so madd weighs both of them at once */
+IMG_TARGET_SSSE3
+static size_t ssse3_conv_taps(const uint8_t* const* taps, const int16_t* weights, const unsigned int count, uint8_t* out, const size_t size, const unsigned int shift, const int bias)
+{
+    const __m128i zero = _mm_setzero_si128(), sh = _mm_cvtsi32_si128((int)shift);
+    const __m128i round = _mm_set1_epi32(shift ? 1 << (shift - 1) : 0), b = _mm_set1_epi32(bias);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i acc[4] = {round, round, round, round};
+        for (unsigned int t = 0; t < count; t += 2) {
+            const __m128i w = _mm_set1_epi32((int)((uint32_t)(uint16_t)weights[t + 1] << 16 | (uint16_t)weights[t]));
+            const __m128i x = _mm_loadu_si128((const __m128i*)(taps[t] + i));
+            const __m128i y = _mm_loadu_si128((const __m128i*)(taps[t + 1] + i));
+            const __m128i lo = _mm_unpacklo_epi8(x, y), hi = _mm_unpackhi_epi8(x, y);
+            acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+            acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+            acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+            acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+        }
+        for (int j = 0; j < 4; j++) {
+            acc[j] = _mm_add_epi32(_mm_sra_epi32(acc[j], sh), b);
+        }
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(acc[0], acc[1]), _mm_packs_epi32(acc[2], acc[3])));
+    }
+    return i;
+}
+
+static size_t simd_conv_taps(const uint8_t* const* taps, const int16_t* weights, const unsigned int count, uint8_t* out, const size_t size, const unsigned int shift, const int bias)
+{
+    if (!img_simd_ssse3()) return 0;
+    return ssse3_conv_taps(taps, weights, count, out, size, shift, bias);
+}
+
+#elif defined(IMG_SIMD_NEON)
+
+static size_t simd_conv_taps(const uint8_t* const* taps, const int16_t* weights, const unsigned int count, uint8_t* out, const size_t size, const unsigned int shift, const int bias)
+{
+    const int32x4_t sh = vdupq_n_s32(-(int)shift), b = vdupq_n_s32(bias);
+    const int32x4_t round = vdupq_n_s32(shift ? 1 << (shift - 1) : 0);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        int32x4_t acc[4] = {round, round, round, round};
+        for (unsigned int t = 0; t < count; t++) {
+            const uint8x16_t x = vld1q_u8(taps[t] + i);
+            const int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(x)));
+            const int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(x)));
+            acc[0] = vmlal_n_s16(acc[0], vget_low_s16(lo), weights[t]);
+            acc[1] = vmlal_n_s16(acc[1], vget_high_s16(lo), weights[t]);
+            acc[2] = vmlal_n_s16(acc[2], vget_low_s16(hi), weights[t]);
+            acc[3] = vmlal_n_s16(acc[3], vget_high_s16(hi), weights[t]);
+        }
+        for (int j = 0; j < 4; j++) {
+            acc[j] = vaddq_s32(vshlq_s32(acc[j], sh), b);
+        }
+        const int16x8_t p0 = vcombine_s16(vqmovn_s32(acc[0]), vqmovn_s32(acc[1]));
+        const int16x8_t p1 = vcombine_s16(vqmovn_s32(acc[2]), vqmovn_s32(acc[3]));
+        vst1q_u8(out + i, vcombine_u8(vqmovun_s16(p0), vqmovun_s16(p1)));
+    }
+    return i;
+}
+
+#else
+
+static size_t simd_conv_taps(const uint8_t* const* taps, const int16_t* weights, const unsigned int count, uint8_t* out, const size_t size, const unsigned int shift, const int bias)
+{
+    (void)taps, (void)weights, (void)count, (void)out, (void)size, (void)shift, (void)bias;
+    return 0;
+}
+
+#endif
+
+static void conv_apply(const conv_pass_t* pass, const uint8_t* const* rows, const uint8_t** taps, uint8_t* out, const size_t size)
+{
+    for (unsigned int t = 0; t < pass->count; t++) {
+        taps[t] = rows[pass->row[t]] + pass->offset[t];
+    }
+    const size_t i = simd_conv_taps(taps, pass->weight, pass->count, out, size, pass->shift, pass->bias);
+    conv_taps_scalar(taps, pass->weight, pass->count, out, i, size, pass->shift, pass->bias);
+}
+
+/* row holds the pixels after left pixels of room, the room on both sides
+ * repeats the outermost pixels */
+static void conv_pad(uint8_t* row, const unsigned int width, const unsigned int channels, const unsigned int left, const unsigned int right)
+{
+    const uint8_t* first = row + (size_t)left * channels;
+    const uint8_t* last = first + (size_t)(width - 1) * channels;
+    for (unsigned int x = 0; x < left; x++) {
+        memcpy(row + (size_t)x * channels, first, channels);
+    }
+    for (unsigned int x = 0; x < right; x++) {
+        memcpy(row + (size_t)(left + width + x) * channels, last, channels);
+    }
+}
+
+static const uint8_t* conv_src_row(const bmp_t* src, const int y)
+{
+    return row_at(src, y < 0 ? 0 : y >= (int)src->height ? (int)src->height - 1 : y);
+}
+
+/* a band keeps a ring of the kernel height in rows, so only the halo rows
+ * above and below the band are read twice */
+static void conv_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const conv_job_t* job = arg;
+    const bmp_t* src = job->src;
+    bmp_t* dst = job->dst;
+    const unsigned int width = src->width, channels = src->channels;
+    const unsigned int kw = job->width, kh = job->height, left = kw / 2, top = kh / 2;
+    const size_t size = (size_t)width * channels, padded = (size_t)(width + kw - 1) * channels;
+    const unsigned int taps = job->pass[0].count > job->pass[1].count ? job->pass[0].count : job->pass[1].count;
+
+    /* the ring holds padded rows for 2D and filtered rows when rows go first */
+    const size_t slot = job->mode == CONV_ROWS_FIRST ? size : padded;
+    const unsigned int slots = job->mode == CONV_COLUMNS_FIRST ? 0 : kh;
+    const uint8_t** rows = malloc((kh + taps) * sizeof(uint8_t*) + slot * slots + padded);
+    if (!rows) {
+        fprintf(stderr, "imgtool could not allocate memory for convolution\n");
+        return;
+    }
+    const uint8_t** ptrs = rows + kh;
+    uint8_t* ring = (uint8_t*)(ptrs + taps);
+    uint8_t* temp = ring + slot * slots;
+    const uint8_t* line = temp;
+
+    for (unsigned int y = begin; y < end; y++) {
+        uint8_t* out = row_at(dst, y);
+        if (job->mode == CONV_COLUMNS_FIRST) {
+            for (unsigned int i = 0; i < kh; i++) {
+                rows[i] = conv_src_row(src, (int)(y + i) - (int)top);
+            }
+            conv_apply(&job->pass[0], rows, ptrs, temp + (size_t)left * channels, size);
+            conv_pad(temp, width, channels, left, kw - 1 - left);
+            conv_apply(&job->pass[1], &line, ptrs, out, size);
+        } else {
+            for (unsigned int i = y == begin ? 0 : kh - 1; i < kh; i++) {
+                uint8_t* r = ring + (size_t)((y + i) % kh) * slot;
+                uint8_t* pad = job->mode == CONV_2D ? r : temp;
+                memcpy(pad + (size_t)left * channels, conv_src_row(src, (int)(y + i) - (int)top), size);
+                conv_pad(pad, width, channels, left, kw - 1 - left);
+                if (job->mode == CONV_ROWS_FIRST) conv_apply(&job->pass[0], &line, ptrs, r, size);
+            }
+            for (unsigned int i = 0; i < kh; i++) {
+                rows[i] = ring + (size_t)((y + i) % kh) * slot;
+            }
+            conv_apply(&job->pass[job->mode == CONV_ROWS_FIRST], rows, ptrs, out, size);
+        }
+
+        /* alpha is kept as it was */
+        if (channels == 2 || channels == 4) {
+            const uint8_t* s = row_at(src, y);
+            for (size_t i = channels - 1; i < size; i += channels) {
+                out[i] = s[i];
+            }
+        }
+    }
+    free(rows);
+}
+
+/* the largest shift up to CONV_SHIFT that keeps weights in 16 bits and sums in 32 */
+static void conv_fixed(conv_pass_t* pass, const double* w)
+{
+    double peak = 0.0, total = 0.0;
+    for (unsigned int t = 0; t < pass->count; t++) {
+        if (fabs(w[t]) > peak) peak = fabs(w[t]);
+        total += fabs(w[t]);
+    }
+    unsigned int shift = CONV_SHIFT;
+    while (shift && (peak * (1 << shift) > 32767.0 || total * (1 << shift) * 255.0 > 1073741824.0)) {
+        --shift;
+    }
+    for (unsigned int t = 0; t < pass->count; t++) {
+        const double v = w[t] * (1 << shift);
+        pass->weight[t] = (int16_t)(v > 32767.0 ? 32767 : v < -32767.0 ? -32767 : lround(v));
+    }
+    pass->shift = shift;
+}
+
+static void conv_tap(conv_pass_t* pass, double* w, const unsigned int row, const size_t offset, const double weight)
+{
+    pass->row[pass->count] = row;
+    pass->offset[pass->count] = offset;
+    w[pass->count++] = weight;
+}
+
+/* taps go in pairs for the vector kernels, an odd one out gets a zero twin */
+static void conv_even(conv_pass_t* pass, double* w)
+{
+    if (pass->count % 2) conv_tap(pass, w, pass->row[pass->count - 1], pass->offset[pass->count - 1], 0.0);
+}
+
+/* the rank one test is exact on integers against the largest entry, the first
+ * pass rounds to 8 bits so the second may amplify that error at most twice */
+static conv_mode_enum conv_mode(const int* kernel, const unsigned int kw, const unsigned int kh, const int divisor, unsigned int* pr, unsigned int* pc)
+{
+    const unsigned int n = kw * kh;
+    unsigned int p = 0;
+    for (unsigned int i = 1; i < n; i++) {
+        if (abs(kernel[i]) > abs(kernel[p])) p = i;
+    }
+    *pr = p / kw, *pc = p % kw;
+    if (kw == 1 || kh == 1 || !kernel[p]) return CONV_2D;
+
+    for (unsigned int i = 0; i < kh; i++) {
+        for (unsigned int j = 0; j < kw; j++) {
+            if ((int64_t)kernel[i * kw + j] * kernel[p] != (int64_t)kernel[i * kw + *pc] * kernel[*pr * kw + j]) return CONV_2D;
+        }
+    }
+
+    int rows = 1, columns = 1;
+    int64_t gain[2] = {0, 0};
+    for (unsigned int j = 0; j < kw; j++) {
+        if ((int64_t)kernel[*pr * kw + j] * kernel[p] < 0) rows = 0;
+        int64_t line = 0;
+        for (unsigned int i = 0; i < kh; i++) {
+            line += kernel[i * kw + j];
+        }
+        gain[1] += line < 0 ? -line : line;
+    }
+    for (unsigned int i = 0; i < kh; i++) {
+        if ((int64_t)kernel[i * kw + *pc] * kernel[p] < 0) columns = 0;
+        int64_t line = 0;
+        for (unsigned int j = 0; j < kw; j++) {
+            line += kernel[i * kw + j];
+        }
+        gain[0] += line < 0 ? -line : line;
+    }
+    const int64_t limit = 2 * (int64_t)abs(divisor);
+    if (rows && gain[0] <= limit) return CONV_ROWS_FIRST;
+    if (columns && gain[1] <= limit) return CONV_COLUMNS_FIRST;
+    return CONV_2D;
+}
+
+void bmp_convolve_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const int* kernel, const unsigned int kw, const unsigned int kh, int divisor, const int bias)
+{
+    if (!kernel || !kw || !kh) {
+        fprintf(stderr, "imgtool needs a kernel of at least 1x1 to convolve\n");
+        return;
+    }
+    const unsigned int n = kw * kh, channels = bitmap->channels;
+    if (!divisor) {
+        for (unsigned int i = 0; i < n; i++) {
+            divisor += kernel[i];
+        }
+        if (!divisor) divisor = 1;
+    }
+
+    conv_job_t job = {bitmap, dst, {{0}}, kw, kh, CONV_2D};
+    unsigned int pr, pc;
+    job.mode = conv_mode(kernel, kw, kh, divisor, &pr, &pc);
+
+    /* one block for the taps of both passes, each pass has room for n + 1 */
+    const size_t cap = n + 1;
+    void* block = malloc(2 * cap * (sizeof(unsigned int) + sizeof(size_t) + sizeof(int16_t) + sizeof(double)));
+    if (!block) {
+        fprintf(stderr, "imgtool could not allocate memory for convolution\n");
+        return;
+    }
+    double* w = block;
+    size_t* offsets = (size_t*)(w + 2 * cap);
+    unsigned int* rows = (unsigned int*)(offsets + 2 * cap);
+    int16_t* weights = (int16_t*)(rows + 2 * cap);
+    for (int k = 0; k < 2; k++) {
+        job.pass[k].row = rows + k * cap;
+        job.pass[k].offset = offsets + k * cap;
+        job.pass[k].weight = weights + k * cap;
+    }
+
+    conv_pass_t* first = job.pass, *second = job.pass + 1;
+    if (job.mode == CONV_2D) {
+        for (unsigned int i = 0; i < kh; i++) {
+            for (unsigned int j = 0; j < kw; j++) {
+                if (kernel[i * kw + j]) conv_tap(first, w, i, (size_t)j * channels, (double)kernel[i * kw + j] / divisor);
+            }
+        }
+        conv_even(first, w);
+        conv_fixed(first, w);
+        first->bias = bias;
+    } else {
+        /* the first pass is one line of the kernel over its sum, the second
+         * sums the kernel across the first so the product is the kernel */
+        const int rows_first = job.mode == CONV_ROWS_FIRST;
+        const unsigned int along = rows_first ? kw : kh, across = rows_first ? kh : kw;
+        int64_t sum = 0;
+        for (unsigned int k = 0; k < along; k++) {
+            sum += rows_first ? kernel[pr * kw + k] : kernel[k * kw + pc];
+        }
+        for (unsigned int k = 0; k < along; k++) {
+            const int v = rows_first ? kernel[pr * kw + k] : kernel[k * kw + pc];
+            conv_tap(first, w, rows_first ? 0 : k, rows_first ? (size_t)k * channels : 0, (double)v / (double)sum);
+        }
+        conv_even(first, w);
+        conv_fixed(first, w);
+        for (unsigned int k = 0; k < across; k++) {
+            int64_t line = 0;
+            for (unsigned int l = 0; l < along; l++) {
+                line += rows_first ? kernel[k * kw + l] : kernel[l * kw + k];
+            }
+            conv_tap(second, w + cap, rows_first ? k : 0, rows_first ? 0 : (size_t)k * channels, (double)line / divisor);
+        }
+        conv_even(second, w + cap);
+        conv_fixed(second, w + cap);
+        second->bias = bias;
+    }
+
+    bmp_reserve(dst, bitmap->width, bitmap->height, channels);
+    if (dst->width && dst->height) {
+        img_parallel_for(conv_rows, &job, dst->height, row_grain((size_t)dst->width * channels) + kh);
+    }
+    free(block);
+}
+
+bmp_t bmp_convolve(const bmp_t* restrict bitmap, const int* kernel, const unsigned int kw, const unsigned int kh, const int divisor, const int bias)
+{
+    bmp_t new_bitmap = {0};
+    bmp_convolve_into(bitmap, &new_bitmap, kernel, kw, kh, divisor, bias);
+    return new_bitmap;
+}
+
+void bmp_convolve_preset_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const img_kernel_enum preset)
+{
+    switch (preset) {
+        case IMG_KERNEL_SHARPEN: bmp_convolve_into(bitmap, dst, conv_sharpen, 3, 3, 1, 0); break;
+        case IMG_KERNEL_EDGE: bmp_convolve_into(bitmap, dst, conv_edge, 3, 3, 1, 0); break;
+        case IMG_KERNEL_EMBOSS: bmp_convolve_into(bitmap, dst, conv_emboss, 3, 3, 1, 0); break;
+        case IMG_KERNEL_UNSHARP: bmp_convolve_into(bitmap, dst, conv_unsharp, 5, 5, 256, 0); break;
+    }
+}
+
+bmp_t bmp_convolve_preset(const bmp_t* restrict bitmap, const img_kernel_enum preset)
+{
+    bmp_t new_bitmap = {0};
+    bmp_convolve_preset_into(bitmap, &new_bitmap, preset);
+    return new_bitmap;
+}
@@ -167,6 +167,7 @@ bmp_t* gif_to_bmp(const gif_t* restrict gif, unsigned int* count)
         ret[i].width = width;
         ret[i].height = height;
         ret[i].channels = channels;
+        ret[i].stride = width * channels;
         ret[i].pixels = (uint8_t*)malloc(width * height * channels);
         memcpy(ret[i].pixels, gif->frames[i], width * height * channels);
     }
@@ -177,15 +178,11 @@ bmp_t* gif_to_bmp(const gif_t* restrict gif, unsigned int* count)
 gif_t* bmp_to_gif(const bmp_t* restrict bitmaps, const unsigned int count)
 {
     static const uint8_t white[3] = {255};
-    const unsigned int channels = bitmaps->channels;
 
     gif_t* gif = gif_new(bitmaps->width, bitmaps->height, &white[0]);
     for (unsigned int i = 0; i < count; i++) {
-        if (channels == 4) {
-            bmp_t b = bmp_transform(&bitmaps[i], 3);
-            gif_push_frame(gif, b.pixels);
-            bmp_free(&b);
-        } else gif_push_frame(gif, bitmaps[i].pixels);
+        bmp_t b = bitmaps[i].channels == 3 ? bmp_copy(&bitmaps[i]) : bmp_transform(&bitmaps[i], 3);
+        gif_push_frame(gif, b.pixels);
     }
     return gif;
 }
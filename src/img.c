@@ -2,12 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "simd.h"
 
 /***********************
  -> img save and load <- 
 ***********************/
 
 static int jpeg_quality = 100;
+static int native_channels;
 
 static char* img_parse_suffix(const char* restrict path)
 {
@@ -60,12 +62,13 @@ static img_format_enum img_parse_format(const char* restrict suffix)
     return IMG_FORMAT_NULL;
 }
 
-static uint8_t* img_file_load_any(const char* restrict path, unsigned int* width, unsigned int* height, const img_format_enum format)
+static uint8_t* img_file_load_any(const char* restrict path, unsigned int* width, unsigned int* height, unsigned int* channels, const img_format_enum format, const unsigned int denom)
 {
     if (format == IMG_FORMAT_PNG) {
+        if (native_channels) return png_file_load_native(path, width, height, channels);
         return png_file_load(path, width, height);
     } else if (format == IMG_FORMAT_JPG) {
-        return jpeg_file_load(path, width, height);
+        return jpeg_file_load_scaled(path, width, height, denom);
     } else if (format == IMG_FORMAT_PPM) {
         return ppm_file_load(path, width, height);
     } else if (format == IMG_FORMAT_GIF) {
@@ -89,20 +92,19 @@ static void img_file_write_any(const char* restrict path, const uint8_t* restric
 
 uint8_t* img_transform_buffer(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height, const unsigned int src, const unsigned int dest)
 {
-    uint8_t* ret = NULL;
-    if (src == IMG_RGB && dest == IMG_RGBA) {
-        ret = rgb_to_rgba(buffer, width, height);
-    } else if (src == IMG_RGBA && dest == IMG_RGB) {
-        ret = rgba_to_rgb(buffer, width, height);
-    } else if (src == IMG_RGB && dest == IMG_G) {
-        ret = rgb_to_greyscale(buffer, width, height);
-    } else if (src == IMG_RGBA && dest == IMG_G) {
-        ret = rgba_to_greyscale(buffer, width, height);
-    }
+    if (src < IMG_G || src > IMG_RGBA || dest < IMG_G || dest > IMG_RGBA) return NULL;
+    const size_t count = (size_t)width * height;
+    uint8_t* ret = (uint8_t*)malloc(count * dest);
+    if (ret) img_convert_row(buffer, ret, count, src, dest);
     return ret;
 }
 
 uint8_t* img_file_load(const char* restrict path, unsigned int* width, unsigned int* height, unsigned int* out_channels)
+{
+    return img_file_load_scaled(path, width, height, out_channels, 1);
+}
+
+uint8_t* img_file_load_scaled(const char* restrict path, unsigned int* width, unsigned int* height, unsigned int* out_channels, const unsigned int denom)
 {
     char* suffix = img_parse_suffix(path);
     if (!suffix) return NULL;
@@ -116,7 +118,7 @@ uint8_t* img_file_load(const char* restrict path, unsigned int* width, unsigned
     }
     free(suffix);
 
-    return img_file_load_any(path, width, height, format);
+    return img_file_load_any(path, width, height, out_channels, format, denom);
 }
 
 void img_file_write(const char* restrict path, const uint8_t* restrict img, const unsigned int width, const unsigned int height, const unsigned int in_channels)
@@ -169,3 +171,8 @@ void img_set_jpeg_quality(const int quality)
     jpeg_quality = quality;
 }
 
+void img_set_native_channels(const int native)
+{
+    native_channels = native;
+}
+
@@ -1,6 +1,7 @@
 #include <imgtool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <jpeglib.h>
 
@@ -46,68 +47,142 @@ void jpeg_file_write(const char* restrict path, const uint8_t* restrict data, co
     jpeg_destroy_compress(&cinfo);
 }
 
-uint8_t* jpeg_file_load(const char* restrict path, unsigned int* w, unsigned int* h)
+/* reads only the header, 0 when the file does not start like a JPEG */
+int jpeg_file_info(const char* restrict path, unsigned int* w, unsigned int* h)
 {
-	struct stat file_info;
-	struct jpeg_decompress_struct cinfo;
-	struct jpeg_error_mgr jerr;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    uint8_t soi[2];
 
-	unsigned long bmp_size;
-	uint8_t *bmp_buffer;
-	int row_stride, width, height, pixel_size;
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    if (fread(soi, 1, 2, file) != 2 || soi[0] != 0xFF || soi[1] != 0xD8) {
+        fclose(file);
+        return 0;
+    }
+    rewind(file);
 
-    int rc = stat(path, &file_info);
-    if (rc) {
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    const int rc = jpeg_read_header(&cinfo, TRUE);
+    *w = cinfo.image_width;
+    *h = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    return rc == JPEG_HEADER_OK;
+}
+
+/* decodes the w x h window at x, y of the image scaled by 1 / denom, clipped to
+ * the image; libjpeg scales in the IDCT and libjpeg-turbo skips the rows above
+ * the window and the iMCU columns beside it, so neither builds the full image */
+static uint8_t* jpeg_load(const char* restrict path, unsigned int x, unsigned int y, unsigned int* w, unsigned int* h, const unsigned int denom)
+{
+    struct stat file_info;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    if (stat(path, &file_info)) {
         fprintf(stderr, "imgtool could not get info about JPEG file '%s'\n", path);
         return NULL;
     }
-
-	unsigned long jpg_size = file_info.st_size;
-	uint8_t* jpg_buffer = (uint8_t*)malloc(jpg_size + 100);
-
-	FILE* file = fopen(path, "rb");
+    FILE* file = fopen(path, "rb");
     if (!file) {
         fprintf(stderr, "imgtool could not open JPEG file '%s'\n", path);
         return NULL;
-    } 
-
-	fread(jpg_buffer, jpg_size, 1, file);
-	fclose(file);  
-
-	cinfo.err = jpeg_std_error(&jerr);	
-	jpeg_create_decompress(&cinfo);
-	jpeg_mem_src(&cinfo, jpg_buffer, jpg_size);
-	rc = jpeg_read_header(&cinfo, TRUE);
+    }
+    const unsigned long jpg_size = file_info.st_size;
+    uint8_t* jpg_buffer = (uint8_t*)malloc(jpg_size + 100);
+    if (!jpg_buffer || fread(jpg_buffer, 1, jpg_size, file) != jpg_size) {
+        fprintf(stderr, "imgtool could not read JPEG file '%s'\n", path);
+        free(jpg_buffer);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
 
-	if (rc != 1) {
-		fprintf(stderr, "file '%s' does not seem to be a normal JPEG.\n", path);
-		return NULL;
-	}
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpg_buffer, jpg_size);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        fprintf(stderr, "file '%s' does not seem to be a normal JPEG.\n", path);
+        jpeg_destroy_decompress(&cinfo);
+        free(jpg_buffer);
+        return NULL;
+    }
 
-	jpeg_start_decompress(&cinfo);
+    /* grey JPEGs widen to the RGB every load returns */
+    if (cinfo.jpeg_color_space == JCS_GRAYSCALE) cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom == 2 || denom == 4 || denom == 8 ? denom : 1;
+    jpeg_start_decompress(&cinfo);
 
-    width = cinfo.output_width;
-	height = cinfo.output_height;
-	pixel_size = cinfo.output_components;
+    if (x >= cinfo.output_width) x = cinfo.output_width - 1;
+    if (y >= cinfo.output_height) y = cinfo.output_height - 1;
+    const unsigned int width = *w && *w <= cinfo.output_width - x ? *w : cinfo.output_width - x;
+    const unsigned int height = *h && *h <= cinfo.output_height - y ? *h : cinfo.output_height - y;
+
+    /* fancy upsampling reads the chroma beside each pixel and replicates it past
+     * the edges of the crop, so the crop keeps an iMCU of margin on both sides;
+     * it then starts at the iMCU column left of that */
+    const unsigned int margin = 8 * cinfo.max_h_samp_factor;
+    const unsigned int left = x > margin ? x - margin : 0;
+    const unsigned int right = cinfo.output_width - x - width > margin ? x + width + margin : cinfo.output_width;
+    JDIMENSION offset = left, decoded = right - left;
+    if (decoded < cinfo.output_width) jpeg_crop_scanline(&cinfo, &offset, &decoded);
+    else offset = 0;
+    const size_t pixel_size = cinfo.output_components;
+    const size_t row_stride = decoded * pixel_size, row_size = width * pixel_size;
+    uint8_t* bmp_buffer = (uint8_t*)malloc(row_stride * height);
+    if (!bmp_buffer) {
+        fprintf(stderr, "imgtool could not allocate memory for JPEG file '%s'\n", path);
+        jpeg_destroy_decompress(&cinfo);
+        free(jpg_buffer);
+        return NULL;
+    }
 
-	bmp_size = width * height * pixel_size;
-	bmp_buffer = (uint8_t*)malloc(bmp_size);
-	row_stride = width * pixel_size;
+    if (y) jpeg_skip_scanlines(&cinfo, y);
+    for (unsigned int i = 0; i < height; i++) {
+        uint8_t* buffer_array[1] = {bmp_buffer + row_stride * i};
+        jpeg_read_scanlines(&cinfo, buffer_array, 1);
+    }
+    if (row_stride != row_size) {
+        for (unsigned int i = 0; i < height; i++) {
+            memmove(bmp_buffer + row_size * i, bmp_buffer + row_stride * i + (x - offset) * pixel_size, row_size);
+        }
+    }
 
-	while (cinfo.output_scanline < cinfo.output_height) {
-		uint8_t *buffer_array[1];
-		buffer_array[0] = bmp_buffer + (cinfo.output_scanline) * row_stride;
-		jpeg_read_scanlines(&cinfo, buffer_array, 1);
-	}
-	jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
-	free(jpg_buffer);
+    /* destroying aborts a decode that stopped above the last row */
+    if (cinfo.output_scanline == cinfo.output_height) jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    free(jpg_buffer);
 
     *w = width;
     *h = height;
     return bmp_buffer;
 }
 
+uint8_t* jpeg_file_load(const char* restrict path, unsigned int* w, unsigned int* h)
+{
+    return jpeg_file_load_scaled(path, w, h, 1);
+}
+
+uint8_t* jpeg_file_load_scaled(const char* restrict path, unsigned int* w, unsigned int* h, const unsigned int denom)
+{
+    *w = *h = 0;
+    return jpeg_load(path, 0, 0, w, h, denom);
+}
+
+uint8_t* jpeg_file_load_region(const char* restrict path, const unsigned int x, const unsigned int y, unsigned int* w, unsigned int* h)
+{
+    return jpeg_load(path, x, y, w, h, 1);
+}
+
+uint8_t* jpeg_file_load_region_scaled(const char* restrict path, const unsigned int x, const unsigned int y, unsigned int* w, unsigned int* h, const unsigned int denom)
+{
+    return jpeg_load(path, x, y, w, h, denom);
+}
+
 uint8_t* jpeg_compress(const uint8_t* restrict data, unsigned int* size, const unsigned int width, const unsigned height, const int quality)
 {
     struct jpeg_compress_struct cinfo;
@@ -118,10 +193,9 @@ uint8_t* jpeg_compress(const uint8_t* restrict data, unsigned int* size, const u
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_compress(&cinfo);
 
-    unsigned long s;
-    uint8_t* ret;
+    unsigned long s = 0;
+    uint8_t* ret = NULL;
     jpeg_mem_dest(&cinfo, &ret, &s);
-    *size = (unsigned int)s;
 
     cinfo.image_width = width;
     cinfo.image_height = height;
@@ -139,6 +213,7 @@ uint8_t* jpeg_compress(const uint8_t* restrict data, unsigned int* size, const u
     }
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
+    *size = (unsigned int)s;
     return ret;   
 }
 
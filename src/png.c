@@ -2,12 +2,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <png.h>
+#include <zlib.h>
+#include "thread.h"
+#include "simd.h"
 
 /***********************
  -> PNG save and load <- 
 ***********************/
 
-uint8_t* png_file_load(const char* restrict path, unsigned int* width, unsigned int* height)
+/* rows are decoded straight into the returned buffer, native keeps grey,
+ * grey alpha and RGB as stored instead of widening them to RGBA */
+static uint8_t* png_load(const char* restrict path, unsigned int* width, unsigned int* height, unsigned int* channels, const int native)
 {
     FILE *file = fopen(path, "rb");
     if (!file) {
@@ -20,11 +25,18 @@ uint8_t* png_file_load(const char* restrict path, unsigned int* width, unsigned
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
         fprintf(stderr, "imgtool had a problem trying to read PNG file '%s'\n", path);
+        fclose(file);
         return NULL;
     }
     png_infop info = png_create_info_struct(png);
+    uint8_t* volatile data = NULL;
+    png_bytep* volatile row_pointers = NULL;
     if (!info || setjmp(png_jmpbuf(png))) {
         fprintf(stderr, "imgtool detected a problem reading the PNG file '%s'\n", path);
+        png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+        free(row_pointers);
+        free(data);
+        fclose(file);
         return NULL;
     }
 
@@ -39,57 +51,398 @@ uint8_t* png_file_load(const char* restrict path, unsigned int* width, unsigned
     if (color_type == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png);
     if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) png_set_expand_gray_1_2_4_to_8(png);
     if (png_get_valid(png, info, PNG_INFO_tRNS)) png_set_tRNS_to_alpha(png);
-    if (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_GRAY ||
-            color_type == PNG_COLOR_TYPE_PALETTE) png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
-    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) png_set_gray_to_rgb(png);
+    if (!native) {
+        if (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_GRAY ||
+                color_type == PNG_COLOR_TYPE_PALETTE) png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+        if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) png_set_gray_to_rgb(png);
+    }
     png_read_update_info(png, info);
 
-    png_bytep* row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * h);
+    const unsigned int n = png_get_channels(png, info);
+    const size_t rowbytes = png_get_rowbytes(png, info);
+    data = malloc(rowbytes * h);
+    row_pointers = malloc(sizeof(png_bytep) * h);
+    if (!data || !row_pointers) png_error(png, "out of memory");
     for (unsigned int y = 0; y < h; y++) {
-        row_pointers[y] = (png_byte*)malloc(png_get_rowbytes(png, info));
+        row_pointers[y] = data + rowbytes * y;
     }
     png_read_image(png, row_pointers);
+    png_read_end(png, NULL);
 
-    uint8_t* data = (uint8_t*)malloc(h * w * 4);
-    unsigned int i = 0;
-    for (unsigned int y = 0; y < h; y++) {
-        png_bytep row = row_pointers[y];
-        for (unsigned int x = 0; x < w; x++) {
-            png_bytep px = &row[x * 4];
-            memcpy(&data[i], &px[0], 4);
-            i += 4;
-        }
-    }
-
-    for (unsigned int y = 0; y < h; y++) {
-        free(row_pointers[y]);
-    }
+    png_destroy_read_struct(&png, &info, NULL);
     free(row_pointers);
-    
     fclose(file);
     
     *width = w;
     *height = h;
-    
+    *channels = n;
     return data;
 }
 
-void png_file_write(const char* restrict path, const uint8_t* restrict data, const unsigned int width, const unsigned int height) 
+uint8_t* png_file_load(const char* restrict path, unsigned int* width, unsigned int* height)
 {
-    FILE* file = fopen(path, "wb");
-    if (!file) {
-        fprintf(stderr, "imgtool could not write PNG file '%s'\n", path);
+    unsigned int channels;
+    return png_load(path, width, height, &channels, 0);
+}
+
+uint8_t* png_file_load_native(const char* restrict path, unsigned int* width, unsigned int* height, unsigned int* channels)
+{
+    return png_load(path, width, height, channels, 1);
+}
+
+/* reads only the IHDR, 0 when the file does not start like a PNG */
+int png_file_info(const char* restrict path, unsigned int* width, unsigned int* height)
+{
+    uint8_t head[24];
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    const size_t size = fread(head, 1, 24, file);
+    fclose(file);
+    if (size != 24 || png_sig_cmp(head, 0, 8) || memcmp(head + 12, "IHDR", 4)) return 0;
+    *width = png_get_uint_32(head + 16);
+    *height = png_get_uint_32(head + 20);
+    return 1;
+}
+
+/* strips of at least this many filtered bytes are deflated on their own */
+#define PNG_STRIP (1 << 18)
+#define PNG_HASH 1024
+
+static img_png_options_t png_options = {-1, IMG_PNG_STRATEGY_AUTO, IMG_PNG_FILTER_ADAPTIVE, 0, 0, 0};
+
+void img_set_png_options(const img_png_options_t* options)
+{
+    png_options = *options;
+}
+
+img_png_options_t img_get_png_options(void)
+{
+    return png_options;
+}
+
+/* fast mode trades size for speed with level 1, the sub filter and run lengths,
+ * palette indices are not filtered unless asked to, like libpng does */
+static void png_resolve(int* level, int* strategy, img_png_filter_enum* filter, const int palette)
+{
+    static const int strategies[] = {Z_DEFAULT_STRATEGY, Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE};
+    *level = png_options.fast ? 1 : png_options.level < 0 || png_options.level > 9 ? Z_DEFAULT_COMPRESSION : png_options.level;
+    *filter = png_options.fast ? IMG_PNG_FILTER_SUB : png_options.filter;
+    if (palette && (png_options.fast || *filter == IMG_PNG_FILTER_ADAPTIVE)) *filter = IMG_PNG_FILTER_NONE;
+    const img_png_strategy_enum strategy_option = png_options.fast ? IMG_PNG_STRATEGY_RLE : png_options.strategy;
+    *strategy = strategies[strategy_option];
+    if (strategy_option == IMG_PNG_STRATEGY_AUTO && *filter != IMG_PNG_FILTER_NONE) *strategy = Z_FILTERED;
+}
+
+static uint8_t png_paeth(const int a, const int b, const int c)
+{
+    const int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+/* writes the filter byte and the filtered row, prev is all zero above the first row */
+static void png_filter_row(uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t size, const unsigned int bpp, const img_png_filter_enum filter)
+{
+    static const uint8_t zero[4] = {0};
+    uint8_t* f = out + 1;
+    const size_t head = bpp < size ? bpp : size;
+    out[0] = (uint8_t)filter;
+    if (!prev && (filter == IMG_PNG_FILTER_UP || filter == IMG_PNG_FILTER_PAETH)) {
+        /* with nothing above up is none and paeth is sub, but the byte stays */
+        png_filter_row(out, row, NULL, size, bpp, filter == IMG_PNG_FILTER_UP ? IMG_PNG_FILTER_NONE : IMG_PNG_FILTER_SUB);
+        out[0] = (uint8_t)filter;
         return;
     }
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png) {
-        fprintf(stderr, "imgtool had a problem writing PNG file '%s'\n", path);
-        return;
+    switch (filter) {
+        case IMG_PNG_FILTER_SUB:
+            memcpy(f, row, head);
+            for (size_t i = bpp; i < size; i++) f[i] = (uint8_t)(row[i] - row[i - bpp]);
+            break;
+        case IMG_PNG_FILTER_UP:
+            for (size_t i = 0; i < size; i++) f[i] = (uint8_t)(row[i] - prev[i]);
+            break;
+        case IMG_PNG_FILTER_AVERAGE:
+            if (!prev) prev = zero;
+            for (size_t i = 0; i < head; i++) f[i] = (uint8_t)(row[i] - (prev[prev == zero ? 0 : i] >> 1));
+            if (prev == zero) for (size_t i = bpp; i < size; i++) f[i] = (uint8_t)(row[i] - (row[i - bpp] >> 1));
+            else for (size_t i = bpp; i < size; i++) f[i] = (uint8_t)(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+            break;
+        case IMG_PNG_FILTER_PAETH:
+            for (size_t i = 0; i < head; i++) f[i] = (uint8_t)(row[i] - prev[i]);
+            for (size_t i = bpp; i < size; i++) f[i] = (uint8_t)(row[i] - png_paeth(row[i - bpp], prev[i], prev[i - bpp]));
+            break;
+        default:
+            memcpy(f, row, size);
+            break;
+    }
+}
+
+/* the adaptive heuristic keeps the filter with the smallest sum of signed bytes */
+static void png_filter_adaptive(uint8_t* out, uint8_t* temp, const uint8_t* row, const uint8_t* prev, const size_t size, const unsigned int bpp)
+{
+    unsigned long best = (unsigned long)-1;
+    for (int filter = IMG_PNG_FILTER_NONE; filter <= IMG_PNG_FILTER_PAETH; filter++) {
+        png_filter_row(temp, row, prev, size, bpp, (img_png_filter_enum)filter);
+        unsigned long sum = 0;
+        for (size_t i = 1; i <= size && sum < best; i++) {
+            sum += temp[i] < 128 ? temp[i] : 256 - temp[i];
+        }
+        if (sum < best) {
+            best = sum;
+            memcpy(out, temp, size + 1);
+        }
+    }
+}
+
+typedef struct {
+    uint8_t* out;
+    size_t size;
+    uLong adler, crc;
+    int failed;
+} png_strip_t;
+
+typedef struct {
+    const uint8_t* data;
+    png_strip_t* strips;
+    size_t rowbytes;
+    unsigned int height, rows, count, bpp;
+    int level, strategy;
+    img_png_filter_enum filter;
+} png_job_t;
+
+static const uint8_t png_idat[4] = {'I', 'D', 'A', 'T'};
+
+/* every strip filters its rows and deflates them as a raw stream that ends
+ * on a byte boundary, the first one carries the zlib header */
+static void png_strips(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const png_job_t* job = arg;
+    const size_t rowbytes = job->rowbytes;
+    for (unsigned int s = begin; s < end; s++) {
+        png_strip_t* strip = job->strips + s;
+        const unsigned int y0 = s * job->rows, y1 = y0 + job->rows < job->height ? y0 + job->rows : job->height;
+        const size_t size = (rowbytes + 1) * (y1 - y0);
+        uint8_t* filtered = malloc(size + rowbytes + 1);
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (!filtered || deflateInit2(&z, job->level, Z_DEFLATED, -15, 8, job->strategy) != Z_OK) {
+            strip->failed = 1;
+            free(filtered);
+            continue;
+        }
+
+        for (unsigned int y = y0; y < y1; y++) {
+            const uint8_t* row = job->data + rowbytes * y, *prev = y ? row - rowbytes : NULL;
+            uint8_t* out = filtered + (rowbytes + 1) * (y - y0);
+            if (job->filter == IMG_PNG_FILTER_ADAPTIVE) png_filter_adaptive(out, filtered + size, row, prev, rowbytes, job->bpp);
+            else png_filter_row(out, row, prev, rowbytes, job->bpp, job->filter);
+        }
+        strip->adler = adler32(adler32(0L, Z_NULL, 0), filtered, (uInt)size);
+
+        const size_t head = s ? 0 : 2, bound = deflateBound(&z, (uLong)size) + 16;
+        strip->out = malloc(head + bound);
+        if (!strip->out) {
+            strip->failed = 1;
+            deflateEnd(&z);
+            free(filtered);
+            continue;
+        }
+        if (head) {
+            static const uint8_t flags[4] = {0x01, 0x5E, 0x9C, 0xDA};
+            const int level = job->level < 0 ? 6 : job->level;
+            strip->out[0] = 0x78;
+            strip->out[1] = flags[level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3];
+        }
+        z.next_in = filtered;
+        z.avail_in = (uInt)size;
+        z.next_out = strip->out + head;
+        z.avail_out = (uInt)bound;
+        const int flush = s + 1 == job->count ? Z_FINISH : Z_SYNC_FLUSH;
+        const int ret = deflate(&z, flush);
+        strip->failed = flush == Z_FINISH ? ret != Z_STREAM_END : ret != Z_OK || z.avail_in;
+        strip->size = head + bound - z.avail_out;
+        strip->crc = crc32(crc32(0L, png_idat, 4), strip->out, (uInt)strip->size);
+        deflateEnd(&z);
+        free(filtered);
     }
+}
+
+static void png_put32(uint8_t* p, const uLong v)
+{
+    p[0] = (uint8_t)(v >> 24), p[1] = (uint8_t)(v >> 16), p[2] = (uint8_t)(v >> 8), p[3] = (uint8_t)v;
+}
+
+/* strips bring their crc along, other chunks are summed here */
+static void png_chunk(FILE* file, const char* type, const uint8_t* data, const size_t size, const uLong* crc)
+{
+    uint8_t head[8], tail[4];
+    png_put32(head, (uLong)size);
+    memcpy(head + 4, type, 4);
+    uLong sum = crc32(0L, (const Bytef*)type, 4);
+    if (crc) sum = *crc;
+    else if (size) sum = crc32(sum, data, (uInt)size);
+    png_put32(tail, sum);
+    fwrite(head, 1, 8, file);
+    if (size) fwrite(data, 1, size, file);
+    fwrite(tail, 1, 4, file);
+}
+
+typedef struct {
+    unsigned int channels, colours, alphas;
+    int color_type;
+    uint8_t plte[768], trns[256];
+} png_head_t;
+
+/* pigz style, strips become IDAT chunks of one zlib stream whose checksum
+ * is combined from the adler32 of every strip */
+static int png_write_parallel(FILE* file, const uint8_t* data, const unsigned int width, const unsigned int height, const png_head_t* head)
+{
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    png_job_t job;
+    job.data = data;
+    job.rowbytes = (size_t)width * head->channels;
+    job.height = height;
+    job.bpp = head->channels;
+    job.rows = (unsigned int)(PNG_STRIP / (job.rowbytes + 1) + 1);
+    job.count = (height + job.rows - 1) / job.rows;
+    png_resolve(&job.level, &job.strategy, &job.filter, head->colours != 0);
+    job.strips = calloc(job.count, sizeof(png_strip_t));
+    if (!job.strips) return 0;
+    img_parallel_for(png_strips, &job, job.count, 1);
+
+    int ok = 1;
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (unsigned int s = 0; s < job.count; s++) {
+        const png_strip_t* strip = job.strips + s;
+        ok = ok && !strip->failed;
+        const unsigned int rows = s + 1 == job.count ? height - s * job.rows : job.rows;
+        if (ok) adler = adler32_combine(adler, strip->adler, (z_off_t)((job.rowbytes + 1) * rows));
+    }
+
+    if (ok) {
+        uint8_t ihdr[13];
+        png_put32(ihdr, width);
+        png_put32(ihdr + 4, height);
+        ihdr[8] = 8, ihdr[9] = (uint8_t)head->color_type, ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        fwrite(signature, 1, 8, file);
+        png_chunk(file, "IHDR", ihdr, 13, NULL);
+        if (head->colours) png_chunk(file, "PLTE", head->plte, head->colours * 3, NULL);
+        if (head->alphas) png_chunk(file, "tRNS", head->trns, head->alphas, NULL);
+        for (unsigned int s = 0; s < job.count; s++) {
+            png_chunk(file, "IDAT", job.strips[s].out, job.strips[s].size, &job.strips[s].crc);
+        }
+        uint8_t check[4];
+        png_put32(check, adler);
+        png_chunk(file, "IDAT", check, 4, NULL);
+        png_chunk(file, "IEND", NULL, 0, NULL);
+    }
+    for (unsigned int s = 0; s < job.count; s++) {
+        free(job.strips[s].out);
+    }
+    free(job.strips);
+    return ok;
+}
+
+/* indexes every pixel through an open addressing hash of up to 256 colours,
+ * runs of one colour skip the lookup; returns the colour count or 0 */
+static unsigned int png_palette(const uint8_t* data, const size_t count, uint32_t* colours, uint8_t* index)
+{
+    uint32_t keys[PNG_HASH], last = 0;
+    int16_t slots[PNG_HASH];
+    unsigned int n = 0;
+    uint8_t last_index = 0;
+    memset(slots, -1, sizeof(slots));
+    for (size_t i = 0; i < count; i++) {
+        uint32_t c;
+        memcpy(&c, data + i * 4, 4);
+        if (i && c == last) {
+            index[i] = last_index;
+            continue;
+        }
+        unsigned int h = (c * 2654435761U) >> 22;
+        while (slots[h] >= 0 && keys[h] != c) {
+            h = (h + 1) & (PNG_HASH - 1);
+        }
+        if (slots[h] < 0) {
+            if (n == 256) return 0;
+            keys[h] = c;
+            slots[h] = (int16_t)n;
+            colours[n++] = c;
+        }
+        last = c;
+        last_index = index[i] = (uint8_t)slots[h];
+    }
+    return n;
+}
+
+/* smallest lossless layout of the RGBA pixels: grey when opaque and grey, then
+ * a palette with the translucent entries first so tRNS stays short, then RGB
+ * or grey alpha; NULL keeps RGBA */
+static uint8_t* png_minimal(const uint8_t* data, const size_t count, png_head_t* head)
+{
+    const unsigned int flags = img_scan_rgba(data, count);
+    uint8_t* out = malloc(count * 3);
+    if (!out) return NULL;
+
+    if (flags == (IMG_SCAN_OPAQUE | IMG_SCAN_GREY)) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = data[i * 4];
+        }
+        head->channels = 1, head->color_type = PNG_COLOR_TYPE_GRAY;
+        return out;
+    }
+
+    uint32_t colours[256];
+    const unsigned int n = png_palette(data, count, colours, out);
+    if (n && (size_t)n * 4 < count) {
+        uint8_t remap[256];
+        for (unsigned int pass = 0; pass < 2; pass++) {
+            for (unsigned int i = 0; i < n; i++) {
+                uint8_t px[4];
+                memcpy(px, colours + i, 4);
+                if ((px[3] == 255) != pass) continue;
+                const unsigned int j = head->colours++;
+                memcpy(head->plte + j * 3, px, 3);
+                head->trns[j] = px[3];
+                remap[i] = (uint8_t)j;
+                if (!pass) head->alphas++;
+            }
+        }
+        if (head->alphas) {
+            for (size_t i = 0; i < count; i++) {
+                out[i] = remap[out[i]];
+            }
+        }
+        head->channels = 1, head->color_type = PNG_COLOR_TYPE_PALETTE;
+        return out;
+    }
+
+    if (flags & IMG_SCAN_OPAQUE) {
+        img_convert_row(data, out, count, 4, 3);
+        head->channels = 3, head->color_type = PNG_COLOR_TYPE_RGB;
+    } else if (flags & IMG_SCAN_GREY) {
+        for (size_t i = 0; i < count; i++) {
+            out[i * 2] = data[i * 4];
+            out[i * 2 + 1] = data[i * 4 + 3];
+        }
+        head->channels = 2, head->color_type = PNG_COLOR_TYPE_GRAY_ALPHA;
+    } else {
+        free(out);
+        out = NULL;
+    }
+    return out;
+}
+
+/* libpng does the filtering and deflate on the calling thread */
+static int png_write_serial(FILE* file, const uint8_t* pixels, const unsigned int width, const unsigned int height, const png_head_t* head)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png) return 0;
     png_infop info = png_create_info_struct(png);
+    png_bytep* volatile row_pointers = NULL;
     if (!info || setjmp(png_jmpbuf(png))) {
-        fprintf(stderr, "imgtool detected a problem writing PNG file '%s'\n", path);
-        return;
+        png_destroy_write_struct(&png, info ? &info : NULL);
+        free(row_pointers);
+        return 0;
     }
 
     png_init_io(png, file);
@@ -99,39 +452,60 @@ void png_file_write(const char* restrict path, const uint8_t* restrict data, con
         width, 
         height, 
         8,
-        PNG_COLOR_TYPE_RGBA, 
+        head->color_type, 
         PNG_INTERLACE_NONE, 
         PNG_COMPRESSION_TYPE_DEFAULT, 
         PNG_FILTER_TYPE_DEFAULT
     );
-
-    png_bytep* row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * height);
-    for (unsigned int y = 0; y < height; y++) {
-        row_pointers[y] = (png_byte*)malloc(png_get_rowbytes(png, info));
+    if (head->colours) {
+        png_color plte[256];
+        for (unsigned int i = 0; i < head->colours; i++) {
+            plte[i].red = head->plte[i * 3], plte[i].green = head->plte[i * 3 + 1], plte[i].blue = head->plte[i * 3 + 2];
+        }
+        png_set_PLTE(png, info, plte, (int)head->colours);
+        if (head->alphas) png_set_tRNS(png, info, head->trns, (int)head->alphas, NULL);
     }
 
-    unsigned int i = 0;
+    /* untouched options keep the libpng defaults */
+    static const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+    int level, strategy;
+    img_png_filter_enum filter;
+    png_resolve(&level, &strategy, &filter, head->colours != 0);
+    if (level != Z_DEFAULT_COMPRESSION) png_set_compression_level(png, level);
+    if (png_options.fast || png_options.strategy != IMG_PNG_STRATEGY_AUTO) png_set_compression_strategy(png, strategy);
+    if (filter != IMG_PNG_FILTER_ADAPTIVE) png_set_filter(png, PNG_FILTER_TYPE_BASE, filters[filter]);
+
+    /* libpng only reads the rows, so they point into the pixels */
+    const size_t rowbytes = (size_t)width * head->channels;
+    row_pointers = malloc(sizeof(png_bytep) * height);
+    if (!row_pointers) png_error(png, "out of memory");
     for (unsigned int y = 0; y < height; y++) {
-        png_bytep row = row_pointers[y];
-        for (unsigned int x = 0; x < width; x++) {
-            png_bytep px = &(row[x * 4]);
-            px[0] = data[i + 0];
-            px[1] = data[i + 1];
-            px[2] = data[i + 2];
-            px[3] = data[i + 3];
-            i += 4;
-        }
+        row_pointers[y] = (png_bytep)(size_t)(pixels + rowbytes * y);
     }
 
     png_write_info(png, info);
     png_write_image(png, row_pointers);
     png_write_end(png, NULL);
 
-    for (unsigned int y = 0; y < height; y++) {
-        free(row_pointers[y]);
-    }
+    png_destroy_write_struct(&png, &info);
     free(row_pointers);
-    
-    fclose(file);
+    return 1;
 }
 
+void png_file_write(const char* restrict path, const uint8_t* restrict data, const unsigned int width, const unsigned int height) 
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "imgtool could not write PNG file '%s'\n", path);
+        return;
+    }
+
+    png_head_t head = {4, 0, 0, PNG_COLOR_TYPE_RGBA, {0}, {0}};
+    uint8_t* minimal = png_options.rgba ? NULL : png_minimal(data, (size_t)width * height, &head);
+    const uint8_t* pixels = minimal ? minimal : data;
+    const int parallel = png_options.parallel && (size_t)width * head.channels * height >= 2 * PNG_STRIP;
+    const int ok = parallel ? png_write_parallel(file, pixels, width, height, &head) : png_write_serial(file, pixels, width, height, &head);
+    if (!ok) fprintf(stderr, "imgtool detected a problem writing PNG file '%s'\n", path);
+    free(minimal);
+    fclose(file);
+}
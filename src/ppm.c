@@ -25,6 +25,18 @@ uint8_t* ppm_file_load(const char* restrict path, unsigned int* width, unsigned
     return ret;
 }
 
+/* reads only the header, 0 when the file does not start like a PPM */
+int ppm_file_info(const char* restrict path, unsigned int* width, unsigned int* height)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+
+    char header[256];
+    const int found = fgets(header, 256, file) && sscanf(header, "P6 %u %u 255", width, height) == 2;
+    fclose(file);
+    return found;
+}
+
 void ppm_file_write(const char* restrict path, const uint8_t* restrict img, const unsigned int width, const unsigned int height)
 {
     FILE* file = fopen(path, "wb");
@@ -0,0 +1,533 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "thread.h"
+#include "simd.h"
+
+/**************************
+ -> Filtered resampling  <-
+ *************************/
+
+#define IMG_PI 3.14159265358979323846
+#define RESIZE_BITS 14
+#define RESIZE_ONE (1 << RESIZE_BITS)
+#define RESIZE_HALF (1 << (RESIZE_BITS - 1))
+
+typedef struct {
+    double (*func)(double);
+    double support;
+} resize_filter_t;
+
+/* every output sample reads taps consecutive inputs from start, weights sum to RESIZE_ONE */
+typedef struct {
+    unsigned int* start;
+    int16_t* weights;
+    unsigned int taps;
+} resize_table_t;
+
+typedef struct {
+    const bmp_t* src;
+    bmp_t* dst;
+    const resize_table_t* table;
+    unsigned int offset;
+} resize_job_t;
+
+static double filter_box(double x)
+{
+    return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+}
+
+static double filter_triangle(double x)
+{
+    x = fabs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static double filter_catmull_rom(double x)
+{
+    x = fabs(x);
+    if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+    if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    return 0.0;
+}
+
+static double sinc(double x)
+{
+    if (x == 0.0) return 1.0;
+    x *= IMG_PI;
+    return sin(x) / x;
+}
+
+static double filter_lanczos3(double x)
+{
+    return x > -3.0 && x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+static const resize_filter_t resize_filters[] = {
+    {filter_box, 0.5},
+    {filter_triangle, 1.0},
+    {filter_catmull_rom, 2.0},
+    {filter_lanczos3, 3.0}
+};
+
+static void resize_table_free(resize_table_t* table)
+{
+    free(table->start);
+    free(table->weights);
+    table->start = NULL;
+    table->weights = NULL;
+}
+
+/* centers are aligned and the filter is stretched when downscaling, taps
+ * outside the input are dropped and the remaining weights renormalized */
+static int resize_table(resize_table_t* table, const unsigned int in, const unsigned int out, const img_filter_enum filter)
+{
+    const resize_filter_t* f = &resize_filters[filter];
+    const double scale = (double)in / out;
+    const double stretch = scale > 1.0 ? scale : 1.0;
+    const double support = f->support * stretch;
+    unsigned int taps = (unsigned int)ceil(support) * 2 + 1;
+    if (taps > in) taps = in;
+
+    table->taps = taps;
+    table->start = malloc(out * sizeof(unsigned int));
+    table->weights = calloc((size_t)out * taps, sizeof(int16_t));
+    if (!table->start || !table->weights) {
+        fprintf(stderr, "imgtool could not allocate resize weights\n");
+        resize_table_free(table);
+        return 0;
+    }
+
+    double w[taps];
+    for (unsigned int i = 0; i < out; i++) {
+        const double center = (i + 0.5) * scale;
+        int lo = (int)(center - support + 0.5), hi = (int)(center + support + 0.5);
+        if (lo < 0) lo = 0;
+        if (hi > (int)in) hi = (int)in;
+        if (hi - lo > (int)taps) hi = lo + (int)taps;
+
+        double sum = 0.0;
+        for (int x = lo; x < hi; x++) {
+            w[x - lo] = f->func((x - center + 0.5) / stretch);
+            sum += w[x - lo];
+        }
+
+        const unsigned int start = (unsigned int)lo + taps <= in ? (unsigned int)lo : in - taps;
+        int16_t* weights = table->weights + (size_t)i * taps + (lo - start);
+        int total = 0, peak = 0;
+        for (int x = 0; x < hi - lo; x++) {
+            weights[x] = (int16_t)lround(sum != 0.0 ? w[x] / sum * RESIZE_ONE : 0.0);
+            total += weights[x];
+            if (weights[x] > weights[peak]) peak = x;
+        }
+        /* rounding leftovers go to the heaviest tap so flat areas stay flat */
+        weights[peak] += RESIZE_ONE - total;
+        table->start[i] = start;
+    }
+    return 1;
+}
+
+static inline uint8_t resize_clamp(const int acc)
+{
+    const int v = acc >> RESIZE_BITS;
+    return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+#ifdef IMG_SIMD_SSSE3
+
+/* channel pairs of two adjacent pixels, interleaved for the 16 bit multiply add */
+IMG_TARGET_SSSE3
+static __m128i ssse3_pair_mask(const unsigned int channels)
+{
+    switch (channels) {
+        case 1: return _mm_setr_epi8(0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        case 2: return _mm_setr_epi8(0, 2, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        case 3: return _mm_setr_epi8(0, 3, 1, 4, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    }
+    return _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+}
+
+IMG_TARGET_SSSE3
+static void ssse3_resize_row_h(const uint8_t* src, const unsigned int bytes, uint8_t* dst, const unsigned int width, const unsigned int channels, const resize_table_t* table)
+{
+    const __m128i mask = ssse3_pair_mask(channels), zero = _mm_setzero_si128();
+    const unsigned int taps = table->taps;
+    for (unsigned int x = 0; x < width; x++, dst += channels) {
+        const int16_t* w = table->weights + (size_t)x * taps;
+        const uint8_t* p = src + table->start[x] * channels;
+        __m128i acc = _mm_set1_epi32(RESIZE_HALF);
+        for (unsigned int k = 0; k < taps; k += 2, p += 2 * channels) {
+            /* a lone last tap or a pair at the end of the row goes through a zero padded copy */
+            const unsigned int n = k + 1 < taps ? 2 : 1;
+            __m128i v;
+            if (n == 2 && (size_t)(p - src) + 8 <= bytes) v = _mm_loadl_epi64((const __m128i*)p);
+            else {
+                uint8_t tmp[8] = {0};
+                memcpy(tmp, p, n * channels);
+                v = _mm_loadl_epi64((const __m128i*)tmp);
+            }
+            const __m128i wv = _mm_unpacklo_epi16(_mm_set1_epi16(w[k]), _mm_set1_epi16(n == 2 ? w[k + 1] : 0));
+            v = _mm_unpacklo_epi8(_mm_shuffle_epi8(v, mask), zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(v, wv));
+        }
+        acc = _mm_srai_epi32(acc, RESIZE_BITS);
+        acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), zero);
+        const uint32_t px = (uint32_t)_mm_cvtsi128_si32(acc);
+        memcpy(dst, &px, channels);
+    }
+}
+
+IMG_TARGET_SSSE3
+static unsigned int ssse3_resize_row_v(const uint8_t** rows, const int16_t* w, const unsigned int taps, uint8_t* dst, const unsigned int bytes)
+{
+    const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi32(RESIZE_HALF);
+    unsigned int x = 0;
+    for (; x + 16 <= bytes; x += 16) {
+        __m128i a0 = half, a1 = half, a2 = half, a3 = half;
+        for (unsigned int k = 0; k < taps; k += 2) {
+            const int pair = k + 1 < taps;
+            const __m128i wv = _mm_unpacklo_epi16(_mm_set1_epi16(w[k]), _mm_set1_epi16(pair ? w[k + 1] : 0));
+            const __m128i v0 = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+            const __m128i v1 = _mm_loadu_si128((const __m128i*)(rows[k + pair] + x));
+            const __m128i lo = _mm_unpacklo_epi8(v0, v1), hi = _mm_unpackhi_epi8(v0, v1);
+            a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wv));
+            a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wv));
+            a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wv));
+            a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wv));
+        }
+        const __m128i lo = _mm_packs_epi32(_mm_srai_epi32(a0, RESIZE_BITS), _mm_srai_epi32(a1, RESIZE_BITS));
+        const __m128i hi = _mm_packs_epi32(_mm_srai_epi32(a2, RESIZE_BITS), _mm_srai_epi32(a3, RESIZE_BITS));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+#endif
+
+static void resize_row_h(const uint8_t* src, const unsigned int bytes, uint8_t* dst, const unsigned int width, const unsigned int channels, const resize_table_t* table)
+{
+#ifdef IMG_SIMD_SSSE3
+    if (img_simd_ssse3()) {
+        ssse3_resize_row_h(src, bytes, dst, width, channels, table);
+        return;
+    }
+#endif
+    (void)bytes;
+    const unsigned int taps = table->taps;
+    for (unsigned int x = 0; x < width; x++, dst += channels) {
+        const int16_t* w = table->weights + (size_t)x * taps;
+        const uint8_t* p = src + table->start[x] * channels;
+        for (unsigned int c = 0; c < channels; c++) {
+            int acc = RESIZE_HALF;
+            for (unsigned int k = 0; k < taps; k++) {
+                acc += w[k] * p[k * channels + c];
+            }
+            dst[c] = resize_clamp(acc);
+        }
+    }
+}
+
+static void resize_row_v(const uint8_t** rows, const int16_t* w, const unsigned int taps, uint8_t* dst, const unsigned int bytes)
+{
+    unsigned int x = 0;
+#ifdef IMG_SIMD_SSSE3
+    if (img_simd_ssse3()) x = ssse3_resize_row_v(rows, w, taps, dst, bytes);
+#endif
+    for (; x < bytes; x++) {
+        int acc = RESIZE_HALF;
+        for (unsigned int k = 0; k < taps; k++) {
+            acc += w[k] * rows[k][x];
+        }
+        dst[x] = resize_clamp(acc);
+    }
+}
+
+/* horizontal pass, job rows are offset into the source when only a band is needed */
+static void resize_rows_h(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const resize_job_t* job = arg;
+    const bmp_t* src = job->src;
+    for (unsigned int y = begin; y < end; y++) {
+        const unsigned int sy = y + job->offset;
+        resize_row_h(row_at(src, sy), src->width * src->channels, row_at(job->dst, y), job->dst->width, src->channels, job->table);
+    }
+}
+
+static void resize_rows_v(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const resize_job_t* job = arg;
+    const resize_table_t* table = job->table;
+    const uint8_t* rows[table->taps];
+    for (unsigned int y = begin; y < end; y++) {
+        for (unsigned int k = 0; k < table->taps; k++) {
+            rows[k] = row_at(job->src, table->start[y] + k - job->offset);
+        }
+        const int16_t* w = table->weights + (size_t)y * table->taps;
+        resize_row_v(rows, w, table->taps, row_at(job->dst, y), job->dst->width * job->dst->channels);
+    }
+}
+
+/* exact coverage of each output pixel, in units of 1 / out of a source pixel so
+ * every weight is an integer, inner pixels weigh a full out and the edges less */
+typedef struct {
+    unsigned int *start, *count, *first, *last;
+    unsigned int unit;
+} area_axis_t;
+
+typedef struct {
+    const bmp_t* src;
+    bmp_t* dst;
+    area_axis_t h, v;
+} area_job_t;
+
+static void area_axis_free(area_axis_t* axis)
+{
+    free(axis->start);
+    axis->start = NULL;
+}
+
+static int area_axis(area_axis_t* axis, const unsigned int in, const unsigned int out)
+{
+    axis->start = malloc(4 * (size_t)out * sizeof(unsigned int));
+    if (!axis->start) {
+        fprintf(stderr, "imgtool could not allocate area weights\n");
+        return 0;
+    }
+    axis->count = axis->start + out;
+    axis->first = axis->count + out;
+    axis->last = axis->first + out;
+    axis->unit = out;
+
+    for (unsigned int i = 0; i < out; i++) {
+        const unsigned long long lo = (unsigned long long)i * in, hi = lo + in;
+        const unsigned int s = (unsigned int)(lo / out), e = (unsigned int)((hi + out - 1) / out);
+        const unsigned long long edge = (unsigned long long)(s + 1) * out;
+        axis->start[i] = s;
+        axis->count[i] = e - s;
+        axis->first[i] = (unsigned int)((edge < hi ? edge : hi) - lo);
+        axis->last[i] = (unsigned int)(hi - (unsigned long long)(e - 1) * out);
+    }
+    return 1;
+}
+
+#ifdef IMG_SIMD_SSSE3
+
+/* bytes widen to 32 bit pairs with a zero high half, so a 16 bit multiply
+ * add by (w, 0) is the exact product for weights below 32768 */
+IMG_TARGET_SSSE3
+static unsigned int ssse3_area_row_v(const uint8_t* src, uint32_t* sum, const unsigned int w, const unsigned int bytes)
+{
+    const __m128i zero = _mm_setzero_si128(), wv = _mm_set1_epi32((int)w);
+    unsigned int x = 0;
+    if (w > 32767) return 0;
+    for (; x + 16 <= bytes; x += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        const __m128i p[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+        };
+        for (unsigned int i = 0; i < 4; i++) {
+            __m128i* s = (__m128i*)(sum + x + 4 * i);
+            _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_madd_epi16(p[i], wv)));
+        }
+    }
+    return x;
+}
+
+#elif defined(IMG_SIMD_NEON)
+
+static unsigned int neon_area_row_v(const uint8_t* src, uint32_t* sum, const unsigned int w, const unsigned int bytes)
+{
+    unsigned int x = 0;
+    for (; x + 16 <= bytes; x += 16) {
+        const uint8x16_t v = vld1q_u8(src + x);
+        const uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(sum + x, vmlaq_n_u32(vld1q_u32(sum + x), vmovl_u16(vget_low_u16(lo)), w));
+        vst1q_u32(sum + x + 4, vmlaq_n_u32(vld1q_u32(sum + x + 4), vmovl_u16(vget_high_u16(lo)), w));
+        vst1q_u32(sum + x + 8, vmlaq_n_u32(vld1q_u32(sum + x + 8), vmovl_u16(vget_low_u16(hi)), w));
+        vst1q_u32(sum + x + 12, vmlaq_n_u32(vld1q_u32(sum + x + 12), vmovl_u16(vget_high_u16(hi)), w));
+    }
+    return x;
+}
+
+#endif
+
+/* adds a source row weighted by its vertical coverage, channels are just bytes here */
+static void area_row_v(const uint8_t* src, uint32_t* sum, const unsigned int w, const unsigned int bytes)
+{
+    unsigned int x = 0;
+#ifdef IMG_SIMD_SSSE3
+    if (img_simd_ssse3()) x = ssse3_area_row_v(src, sum, w, bytes);
+#elif defined(IMG_SIMD_NEON)
+    x = neon_area_row_v(src, sum, w, bytes);
+#endif
+    for (; x < bytes; x++) {
+        sum[x] += w * src[x];
+    }
+}
+
+/* weighs the column sums by horizontal coverage and divides once with rounding */
+static void area_row_h(const uint32_t* sum, uint8_t* dst, const area_axis_t* axis, const unsigned int width, const unsigned int channels, const unsigned long long total)
+{
+    for (unsigned int x = 0; x < width; x++, dst += channels) {
+        const uint32_t* p = sum + (size_t)axis->start[x] * channels;
+        const uint32_t* q = p + (size_t)(axis->count[x] - 1) * channels;
+        const unsigned int n = axis->count[x];
+        uint64_t mid[4] = {0, 0, 0, 0};
+        for (unsigned int k = 1; k + 1 < n; k++) {
+            for (unsigned int c = 0; c < channels; c++) {
+                mid[c] += p[k * channels + c];
+            }
+        }
+        for (unsigned int c = 0; c < channels; c++) {
+            uint64_t acc = (uint64_t)axis->first[x] * p[c];
+            if (n > 1) acc += (uint64_t)axis->unit * mid[c] + (uint64_t)axis->last[x] * q[c];
+            dst[c] = (uint8_t)((acc + total / 2) / total);
+        }
+    }
+}
+
+/* the source rows an output row covers are summed vertically first, into
+ * 32 bit column sums that can't overflow as the weights add up to the height */
+static void area_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const area_job_t* job = arg;
+    const bmp_t* src = job->src;
+    bmp_t* dst = job->dst;
+    const unsigned int bytes = src->width * src->channels;
+    const unsigned long long total = (unsigned long long)src->width * src->height;
+    uint32_t* sum = malloc(bytes * sizeof(uint32_t));
+    if (!sum) {
+        fprintf(stderr, "imgtool could not allocate memory for area resampling\n");
+        return;
+    }
+
+    for (unsigned int y = begin; y < end; y++) {
+        const unsigned int s = job->v.start[y], n = job->v.count[y];
+        memset(sum, 0, bytes * sizeof(uint32_t));
+        for (unsigned int k = 0; k < n; k++) {
+            const unsigned int w = !k ? job->v.first[y] : k + 1 == n ? job->v.last[y] : job->v.unit;
+            area_row_v(row_at(src, s + k), sum, w, bytes);
+        }
+        area_row_h(sum, row_at(dst, y), &job->h, dst->width, dst->channels, total);
+    }
+    free(sum);
+}
+
+static void bmp_area_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const unsigned int width, const unsigned int height)
+{
+    area_job_t job = {bitmap, dst, {0}, {0}};
+    if (area_axis(&job.h, bitmap->width, width) && area_axis(&job.v, bitmap->height, height)) {
+        bmp_reserve(dst, width, height, bitmap->channels);
+        img_parallel_for(area_rows, &job, height, row_grain(width * bitmap->channels));
+    }
+    area_axis_free(&job.h);
+    area_axis_free(&job.v);
+}
+
+void bmp_resize_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const unsigned int width, const unsigned int height, const img_filter_enum filter)
+{
+    if (!width || !height || filter > IMG_FILTER_AREA) {
+        fprintf(stderr, "imgtool cannot resize to %ux%u with filter %d\n", width, height, (int)filter);
+        return;
+    }
+    if (filter == IMG_FILTER_AREA) {
+        bmp_area_into(bitmap, dst, width, height);
+        return;
+    }
+
+    const unsigned int channels = bitmap->channels;
+    const int horizontal = width != bitmap->width, vertical = height != bitmap->height;
+    resize_table_t htable = {0}, vtable = {0};
+    if ((horizontal && !resize_table(&htable, bitmap->width, width, filter)) ||
+        (vertical && !resize_table(&vtable, bitmap->height, height, filter))) {
+        resize_table_free(&htable);
+        return;
+    }
+
+    bmp_reserve(dst, width, height, channels);
+    if (!horizontal && !vertical) {
+        for (unsigned int y = 0; y < height; y++) {
+            memcpy(row_at(dst, y), row_at(bitmap, y), (size_t)width * channels);
+        }
+        return;
+    }
+
+    if (!vertical) {
+        resize_job_t job = {bitmap, dst, &htable, 0};
+        img_parallel_for(resize_rows_h, &job, height, row_grain(width * channels));
+        resize_table_free(&htable);
+        return;
+    }
+
+    if (!horizontal) {
+        resize_job_t job = {bitmap, dst, &vtable, 0};
+        img_parallel_for(resize_rows_v, &job, height, row_grain(width * channels));
+        resize_table_free(&vtable);
+        return;
+    }
+
+    /* runs the pass that shrinks the intermediate most first, the horizontal
+     * pass steps a pixel pair per tap and the vertical one 16 bytes */
+    const double hcost = (double)htable.taps / 2, vcost = (double)vtable.taps * channels / 16;
+    const double hfirst = (double)bitmap->height * width * hcost + (double)height * width * vcost;
+    const double vfirst = (double)height * bitmap->width * vcost + (double)height * width * hcost;
+    bmp_t band = {0};
+    if (vfirst < hfirst) {
+        bmp_reserve(&band, bitmap->width, height, channels);
+        resize_job_t vjob = {bitmap, &band, &vtable, 0};
+        img_parallel_for(resize_rows_v, &vjob, height, row_grain(bitmap->width * channels));
+        resize_job_t hjob = {&band, dst, &htable, 0};
+        img_parallel_for(resize_rows_h, &hjob, height, row_grain(width * channels));
+    } else {
+        /* only the source rows some output row reads are resampled horizontally */
+        const unsigned int first = vtable.start[0], last = vtable.start[height - 1] + vtable.taps;
+        bmp_reserve(&band, width, last - first, channels);
+        resize_job_t hjob = {bitmap, &band, &htable, first};
+        img_parallel_for(resize_rows_h, &hjob, band.height, row_grain(width * channels));
+        resize_job_t vjob = {&band, dst, &vtable, first};
+        img_parallel_for(resize_rows_v, &vjob, height, row_grain(width * channels));
+    }
+    resize_table_free(&htable);
+    resize_table_free(&vtable);
+    bmp_free(&band);
+}
+
+bmp_t bmp_resize(const bmp_t* restrict bitmap, const unsigned int width, const unsigned int height, const img_filter_enum filter)
+{
+    bmp_t new_bitmap = {0};
+    bmp_resize_into(bitmap, &new_bitmap, width, height, filter);
+    return new_bitmap;
+}
+
+/* every level halves the previous one, odd sides are averaged by coverage */
+bmp_t* bmp_pyramid(const bmp_t* restrict bitmap, unsigned int* levels)
+{
+    unsigned int count = 0, width = bitmap->width, height = bitmap->height;
+    while ((width > 1 || height > 1) && (!*levels || count < *levels)) {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        ++count;
+    }
+
+    *levels = 0;
+    if (!count) return NULL;
+    bmp_t* pyramid = calloc(count, sizeof(bmp_t));
+    if (!pyramid) return NULL;
+
+    const bmp_t* prev = bitmap;
+    for (unsigned int i = 0; i < count; i++) {
+        width = prev->width > 1 ? prev->width / 2 : 1;
+        height = prev->height > 1 ? prev->height / 2 : 1;
+        if (width * 2 == prev->width && height * 2 == prev->height) {
+            bmp_reduce_into(prev, pyramid + i);
+        } else bmp_area_into(prev, pyramid + i, width, height);
+        if (!pyramid[i].pixels) break;
+        prev = pyramid + i;
+        *levels = i + 1;
+    }
+    return pyramid;
+}
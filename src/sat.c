@@ -0,0 +1,106 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "thread.h"
+
+/*************************
+ -> Summed area tables  <-
+ ************************/
+
+#define SAT_STRIP 512
+#define sat_row(sat, y) ((sat)->sums + (size_t)((sat)->width + 1) * (sat)->channels * (y))
+
+typedef struct {
+    const bmp_t* src;
+    sat_t* sat;
+} sat_job_t;
+
+/* first pass, every row becomes its own running sum */
+static void sat_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const sat_job_t* job = arg;
+    const bmp_t* src = job->src;
+    const unsigned int channels = src->channels;
+    const size_t size = (size_t)src->width * channels;
+    for (unsigned int y = begin; y < end; y++) {
+        const uint8_t* p = src->pixels + (size_t)src->stride * y;
+        uint64_t* s = sat_row(job->sat, y + 1);
+        memset(s, 0, channels * sizeof(uint64_t));
+        for (size_t i = 0; i < size; i++) {
+            s[i + channels] = s[i] + p[i];
+        }
+    }
+}
+
+/* second pass, strips of columns walk down adding the row above */
+static void sat_columns(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const sat_job_t* job = arg;
+    const sat_t* sat = job->sat;
+    const size_t size = (size_t)(sat->width + 1) * sat->channels;
+    for (unsigned int s = begin; s < end; s++) {
+        const size_t a = (size_t)s * SAT_STRIP, b = size - a < SAT_STRIP ? size : a + SAT_STRIP;
+        for (unsigned int y = 2; y <= sat->height; y++) {
+            const uint64_t* up = sat_row(sat, y - 1);
+            uint64_t* row = sat_row(sat, y);
+            for (size_t i = a; i < b; i++) {
+                row[i] += up[i];
+            }
+        }
+    }
+}
+
+sat_t sat_new(const bmp_t* bitmap)
+{
+    sat_t sat = {bitmap->width, bitmap->height, bitmap->channels, NULL};
+    const size_t size = (size_t)(sat.width + 1) * sat.channels;
+    sat.sums = malloc(size * (sat.height + 1) * sizeof(uint64_t));
+    if (!sat.sums) {
+        fprintf(stderr, "imgtool could not allocate memory for a summed area table\n");
+        memset(&sat, 0, sizeof(sat_t));
+        return sat;
+    }
+
+    memset(sat.sums, 0, size * sizeof(uint64_t));
+    sat_job_t job = {bitmap, &sat};
+    img_parallel_for(sat_rows, &job, sat.height, row_grain((size_t)sat.width * sat.channels));
+    img_parallel_for(sat_columns, &job, (unsigned int)((size + SAT_STRIP - 1) / SAT_STRIP), 1);
+    return sat;
+}
+
+void sat_free(sat_t* sat)
+{
+    free(sat->sums);
+    memset(sat, 0, sizeof(sat_t));
+}
+
+static void sat_clip(const sat_t* sat, unsigned int* x, unsigned int* y, unsigned int* width, unsigned int* height)
+{
+    if (*x > sat->width) *x = sat->width;
+    if (*y > sat->height) *y = sat->height;
+    if (*width > sat->width - *x) *width = sat->width - *x;
+    if (*height > sat->height - *y) *height = sat->height - *y;
+}
+
+void sat_rect(const sat_t* sat, unsigned int x, unsigned int y, unsigned int width, unsigned int height, uint64_t* sums)
+{
+    const unsigned int channels = sat->channels;
+    sat_clip(sat, &x, &y, &width, &height);
+    const uint64_t* top = sat_row(sat, y), *bottom = sat_row(sat, y + height);
+    const size_t a = (size_t)x * channels, b = (size_t)(x + width) * channels;
+    for (unsigned int c = 0; c < channels; c++) {
+        sums[c] = bottom[b + c] - bottom[a + c] - top[b + c] + top[a + c];
+    }
+}
+
+void sat_mean(const sat_t* sat, unsigned int x, unsigned int y, unsigned int width, unsigned int height, uint8_t* px)
+{
+    uint64_t sums[4];
+    sat_clip(sat, &x, &y, &width, &height);
+    sat_rect(sat, x, y, width, height, sums);
+    const uint64_t area = (uint64_t)width * height;
+    for (unsigned int c = 0; c < sat->channels; c++) {
+        px[c] = area ? (uint8_t)((sums[c] + area / 2) / area) : 0;
+    }
+}
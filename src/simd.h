@@ -0,0 +1,51 @@
+#ifndef IMG_SIMD_H
+#define IMG_SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/******************************
+ -> Internal vector kernels  <-
+ *****************************/
+
+/* x86 kernels are compiled for SSSE3 through a target attribute and picked
+ * at runtime, ARM uses NEON when the compiler enables it, anything else
+ * runs the scalar loops */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define IMG_SIMD_SSSE3
+    #include <tmmintrin.h>
+    #define IMG_TARGET_SSSE3 __attribute__((target("ssse3")))
+    #define img_simd_ssse3() __builtin_cpu_supports("ssse3")
+#elif defined(__ARM_NEON)
+    #define IMG_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+/* exact sum / 3 for any sum of three bytes, without the division */
+#define img_div3(sum) (((sum) * 21846) >> 16)
+
+/* converts count packed pixels between any two of the 1 to 4 channel layouts,
+ * grey follows img_set_luma and a missing alpha is opaque */
+void img_convert_row(const uint8_t* src, uint8_t* dst, const size_t count, const unsigned int src_channels, const unsigned int dst_channels);
+
+/* in place pointwise kernels over packed rows, size is in bytes */
+void img_negative_row(uint8_t* row, const size_t size);
+void img_black_and_white_row(uint8_t* row, const size_t count, const unsigned int channels);
+
+/* first byte in [begin, end) where (row ^ pattern) & mask is set, or end, and the
+ * last such byte plus one, or begin; both 48 byte patterns start at the row start
+ * so they line up with every 1 to 4 channel layout */
+size_t img_find_row(const uint8_t* row, const size_t begin, const size_t end, const uint8_t* pattern, const uint8_t* mask);
+size_t img_find_row_last(const uint8_t* row, const size_t begin, const size_t end, const uint8_t* pattern, const uint8_t* mask);
+
+/* IMG_SCAN_OPAQUE when every alpha of count RGBA pixels is 255 and IMG_SCAN_GREY
+ * when red, green and blue all match, stops as soon as neither holds */
+#define IMG_SCAN_OPAQUE 1
+#define IMG_SCAN_GREY 2
+unsigned int img_scan_rgba(const uint8_t* px, const size_t count);
+
+/* 2x2 box average of two source rows into count pixels, rounded down */
+void img_reduce_row(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, const size_t count, const unsigned int channels);
+
+#endif
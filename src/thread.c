@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <imgtool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "thread.h"
+
+/***************************
+ -> Internal thread pool  <-
+ **************************/
+
+typedef struct {
+    img_task_t task;
+    void* arg;
+    unsigned int count, grain, next, busy;
+    unsigned long generation;
+    int quit;
+} img_pool_job_t;
+
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t* pool_workers;
+static unsigned int pool_size;
+static unsigned int pool_threads = 1;
+static img_pool_job_t job;
+
+/* grabs chunks of the current job until none are left, pool_lock held on entry and exit */
+static void img_pool_drain(void)
+{
+    while (job.next < job.count) {
+        const unsigned int begin = job.next;
+        const unsigned int end = job.count - begin > job.grain ? begin + job.grain : job.count;
+        job.next = end;
+        pthread_mutex_unlock(&pool_lock);
+        job.task(job.arg, begin, end);
+        pthread_mutex_lock(&pool_lock);
+    }
+}
+
+static void* img_pool_worker(void* arg)
+{
+    unsigned long generation = 0;
+    (void)arg;
+
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (!job.quit && job.generation == generation) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        if (job.quit) break;
+        generation = job.generation;
+        job.busy++;
+        img_pool_drain();
+        if (--job.busy == 0) pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+static void img_pool_stop(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    job.quit = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (unsigned int i = 0; i < pool_size; i++) {
+        pthread_join(pool_workers[i], NULL);
+    }
+    free(pool_workers);
+    pool_workers = NULL;
+    pool_size = 0;
+    job.quit = 0;
+}
+
+static void img_pool_start(const unsigned int size)
+{
+    pool_workers = (pthread_t*)malloc(size * sizeof(pthread_t));
+    for (pool_size = 0; pool_size < size; pool_size++) {
+        if (pthread_create(&pool_workers[pool_size], NULL, img_pool_worker, NULL)) break;
+    }
+}
+
+unsigned int img_cpu_count(void)
+{
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned int)count : 1;
+}
+
+void img_set_threads(const unsigned int threads)
+{
+    pthread_mutex_lock(&dispatch_lock);
+    pool_threads = threads ? threads : img_cpu_count();
+    if (pool_size + 1 != pool_threads) {
+        if (pool_size) img_pool_stop();
+        if (pool_threads > 1) img_pool_start(pool_threads - 1);
+    }
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+unsigned int img_get_threads(void)
+{
+    return pool_threads;
+}
+
+void img_parallel_for(img_task_t task, void* arg, const unsigned int count, const unsigned int grain)
+{
+    const unsigned int chunk = grain ? grain : 1;
+    if (!pool_size || count <= chunk || pthread_mutex_trylock(&dispatch_lock)) {
+        task(arg, 0, count);
+        return;
+    }
+
+    /* split finer than one chunk per thread so uneven rows still balance */
+    const unsigned int parts = (pool_size + 1) * 4;
+    const unsigned int split = (count + parts - 1) / parts;
+
+    pthread_mutex_lock(&pool_lock);
+    job.task = task;
+    job.arg = arg;
+    job.count = count;
+    job.grain = split > chunk ? split : chunk;
+    job.next = 0;
+    job.generation++;
+    pthread_cond_broadcast(&pool_wake);
+
+    job.busy++;
+    img_pool_drain();
+    job.busy--;
+    while (job.busy) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&dispatch_lock);
+}
@@ -0,0 +1,19 @@
+#ifndef IMG_THREAD_H
+#define IMG_THREAD_H
+
+/***************************
+ -> Internal thread pool  <-
+ **************************/
+
+/* runs task over [begin, end) sub-ranges of [0, count) on the shared pool,
+ * falls back to a serial call when the pool is busy or the range is small */
+
+typedef void (*img_task_t)(void* arg, const unsigned int begin, const unsigned int end);
+
+void img_parallel_for(img_task_t task, void* arg, const unsigned int count, const unsigned int grain);
+
+/* first byte of row y, and a grain of rows that adds up to about 64 KiB */
+#define row_at(bitmap, y) ((bitmap)->pixels + (size_t)(bitmap)->stride * (y))
+#define row_grain(bytes) (65536 / ((bytes) + 1) + 1)
+
+#endif
@@ -1,65 +1,696 @@
 #include <imgtool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include "simd.h"
 
 /*****************************
  -> Greyscale, RGB and RGBA <-
  ****************************/
 
-uint8_t* rgba_to_greyscale(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+/* 15 bit fixed point red, green and blue weights, no weights is a plain average */
+static const unsigned int luma_weights[3][3] = {
+    {0, 0, 0},
+    {9798, 19235, 3735},
+    {6966, 23436, 2366}
+};
+
+static img_luma_enum luma_mode = IMG_LUMA_AVERAGE;
+
+void img_set_luma(const img_luma_enum luma)
+{
+    luma_mode = luma <= IMG_LUMA_REC709 ? luma : IMG_LUMA_AVERAGE;
+}
+
+img_luma_enum img_get_luma(void)
+{
+    return luma_mode;
+}
+
+static const unsigned int* img_luma_weights(void)
+{
+    return luma_mode == IMG_LUMA_AVERAGE ? NULL : luma_weights[luma_mode];
+}
+
+#ifdef IMG_SIMD_SSSE3
+
+IMG_TARGET_SSSE3
+static size_t ssse3_rgb_to_rgba(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count)
 {
-    uint8_t* ret = (uint8_t*)malloc(width * height);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            unsigned int m = 0;
-            m += buffer[(width * y + x) * 4 + 0];
-            m += buffer[(width * y + x) * 4 + 1];
-            m += buffer[(width * y + x) * 4 + 2];
-            ret[(width * y + x)] = (uint8_t)(m / 3);
+    const __m128i lo = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i hi = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+    const __m128i alpha = _mm_setr_epi8(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 48, dst += 64) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)src);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(src + 12));
+        const __m128i c = _mm_loadu_si128((const __m128i*)(src + 24));
+        const __m128i d = _mm_loadu_si128((const __m128i*)(src + 32));
+        _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_shuffle_epi8(a, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_shuffle_epi8(b, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_shuffle_epi8(c, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + 48), _mm_or_si128(_mm_shuffle_epi8(d, hi), alpha));
+    }
+    return i;
+}
+
+IMG_TARGET_SSSE3
+static size_t ssse3_rgba_to_rgb(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count)
+{
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 64, dst += 48) {
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), pack);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 16)), pack);
+        const __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 32)), pack);
+        const __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 48)), pack);
+        _mm_storeu_si128((__m128i*)dst, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    return i;
+}
+
+/* loads 16 pixels of 3 or 4 channels as four registers of 4 byte pixels */
+IMG_TARGET_SSSE3
+static void ssse3_load16(const uint8_t* src, const unsigned int channels, __m128i px[4])
+{
+    if (channels == 4) {
+        for (int i = 0; i < 4; i++) {
+            px[i] = _mm_loadu_si128((const __m128i*)(src + i * 16));
         }
+        return;
     }
-    return ret;
+    const __m128i lo = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i hi = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+    px[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), lo);
+    px[1] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 12)), lo);
+    px[2] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 24)), lo);
+    px[3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 32)), hi);
 }
 
-uint8_t* rgb_to_greyscale(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+/* sums the bytes selected by mask for each 4 byte pixel into 16 bit lanes */
+IMG_TARGET_SSSE3
+static void ssse3_sum16(const __m128i px[4], const __m128i mask, __m128i* lo, __m128i* hi)
+{
+    *lo = _mm_hadd_epi16(_mm_maddubs_epi16(px[0], mask), _mm_maddubs_epi16(px[1], mask));
+    *hi = _mm_hadd_epi16(_mm_maddubs_epi16(px[2], mask), _mm_maddubs_epi16(px[3], mask));
+}
+
+/* weighted red, green and blue of 4 pixels in 32 bit lanes, rounded back to 8 bits */
+IMG_TARGET_SSSE3
+static __m128i ssse3_luma4(const __m128i px, const __m128i weights)
 {
-    uint8_t* ret = (uint8_t*)malloc(width * height);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            unsigned int m = 0;
-            m += buffer[(width * y + x) * 3 + 0];
-            m += buffer[(width * y + x) * 3 + 1];
-            m += buffer[(width * y + x) * 3 + 2];
-            ret[(width * y + x)] = (uint8_t)(m / 3);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), weights);
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), weights);
+    return _mm_srli_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), _mm_set1_epi32(16384)), 15);
+}
+
+/* grey level of 16 pixels, averaged or weighted by luma */
+IMG_TARGET_SSSE3
+static __m128i ssse3_grey16(const __m128i px[4], const unsigned int* luma)
+{
+    if (!luma) {
+        const __m128i rgb = _mm_setr_epi8(1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0);
+        const __m128i third = _mm_set1_epi16(21846);
+        __m128i lo, hi;
+        ssse3_sum16(px, rgb, &lo, &hi);
+        return _mm_packus_epi16(_mm_mulhi_epu16(lo, third), _mm_mulhi_epu16(hi, third));
+    }
+    const __m128i w = _mm_setr_epi16((short)luma[0], (short)luma[1], (short)luma[2], 0, (short)luma[0], (short)luma[1], (short)luma[2], 0);
+    const __m128i lo = _mm_packs_epi32(ssse3_luma4(px[0], w), ssse3_luma4(px[1], w));
+    const __m128i hi = _mm_packs_epi32(ssse3_luma4(px[2], w), ssse3_luma4(px[3], w));
+    return _mm_packus_epi16(lo, hi);
+}
+
+IMG_TARGET_SSSE3
+static size_t ssse3_to_greyscale(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count, const unsigned int channels, const unsigned int* luma)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 16 * channels, dst += 16) {
+        __m128i px[4];
+        ssse3_load16(src, channels, px);
+        _mm_storeu_si128((__m128i*)dst, ssse3_grey16(px, luma));
+    }
+    return i;
+}
+
+IMG_TARGET_SSSE3
+static size_t ssse3_greyscale_to_rgb(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count)
+{
+    const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 16, dst += 48) {
+        const __m128i g = _mm_loadu_si128((const __m128i*)src);
+        _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(g, m0));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_shuffle_epi8(g, m1));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_shuffle_epi8(g, m2));
+    }
+    return i;
+}
+
+IMG_TARGET_SSSE3
+static size_t ssse3_greyscale_to_rgba(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count)
+{
+    const __m128i opaque = _mm_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 16, dst += 64) {
+        const __m128i g = _mm_loadu_si128((const __m128i*)src);
+        const __m128i gg = _mm_unpacklo_epi8(g, g), ga = _mm_unpacklo_epi8(g, opaque);
+        const __m128i hgg = _mm_unpackhi_epi8(g, g), hga = _mm_unpackhi_epi8(g, opaque);
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(gg, ga));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(hgg, hga));
+        _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(hgg, hga));
+    }
+    return i;
+}
+
+/* B&W without luma weights keeps averaging every channel, alpha included */
+IMG_TARGET_SSSE3
+static size_t ssse3_black_and_white(uint8_t* row, const size_t count, const unsigned int channels, const unsigned int* luma)
+{
+    const __m128i all = _mm_set1_epi8(1);
+    const __m128i alpha = _mm_setr_epi8(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+    const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, row += 16 * channels) {
+        __m128i px[4], g;
+        ssse3_load16(row, channels, px);
+        if (channels == 4 && !luma) {
+            __m128i lo, hi;
+            ssse3_sum16(px, all, &lo, &hi);
+            g = _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2));
+        } else g = ssse3_grey16(px, luma);
+
+        if (channels == 3) {
+            _mm_storeu_si128((__m128i*)row, _mm_shuffle_epi8(g, m0));
+            _mm_storeu_si128((__m128i*)(row + 16), _mm_shuffle_epi8(g, m1));
+            _mm_storeu_si128((__m128i*)(row + 32), _mm_shuffle_epi8(g, m2));
+            continue;
+        }
+        const __m128i gg = _mm_unpacklo_epi8(g, g), hgg = _mm_unpackhi_epi8(g, g);
+        __m128i out[4] = {
+            _mm_unpacklo_epi16(gg, gg), _mm_unpackhi_epi16(gg, gg),
+            _mm_unpacklo_epi16(hgg, hgg), _mm_unpackhi_epi16(hgg, hgg)
+        };
+        for (int j = 0; j < 4; j++) {
+            if (luma) out[j] = _mm_or_si128(_mm_andnot_si128(alpha, out[j]), _mm_and_si128(alpha, px[j]));
+            _mm_storeu_si128((__m128i*)(row + j * 16), out[j]);
         }
     }
-    return ret;
+    return i;
 }
 
-uint8_t* rgb_to_rgba(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+IMG_TARGET_SSSE3
+static size_t ssse3_negative(uint8_t* row, const size_t size)
 {
-    uint8_t* ret = (uint8_t*)malloc(width * height * 4);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            ret[(width * y + x) * 4 + 0] = buffer[(width * y + x) * 3 + 0];
-            ret[(width * y + x) * 4 + 1] = buffer[(width * y + x) * 3 + 1];
-            ret[(width * y + x) * 4 + 2] = buffer[(width * y + x) * 3 + 2];
-            ret[(width * y + x) * 4 + 3] = 255;
+    const __m128i ones = _mm_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        _mm_storeu_si128((__m128i*)(row + i), _mm_xor_si128(v, ones));
+    }
+    return i;
+}
+
+/* 2x2 box of two rows, channel pairs of neighbouring pixels are shuffled next to each other */
+IMG_TARGET_SSSE3
+static size_t ssse3_reduce(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, const size_t size, const unsigned int channels)
+{
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i pairs = channels == 4 ? _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15) :
+                          channels == 2 ? _mm_setr_epi8(0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15) :
+                          _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16, r0 += 32, r1 += 32) {
+        __m128i sum[2];
+        for (int j = 0; j < 2; j++) {
+            const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(r0 + j * 16)), pairs);
+            const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(r1 + j * 16)), pairs);
+            sum[j] = _mm_srli_epi16(_mm_add_epi16(_mm_maddubs_epi16(a, ones), _mm_maddubs_epi16(b, ones)), 2);
         }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(sum[0], sum[1]));
     }
-    return ret;
+    return i;
 }
 
-uint8_t* rgba_to_rgb(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+/* returns how many pixels were converted, the scalar loop finishes the rest */
+static size_t simd_convert(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count, const unsigned int sc, const unsigned int dc)
+{
+    if (!img_simd_ssse3()) return 0;
+    switch (sc * 4 + dc) {
+        case 3 * 4 + 4: return ssse3_rgb_to_rgba(src, dst, count);
+        case 4 * 4 + 3: return ssse3_rgba_to_rgb(src, dst, count);
+        case 4 * 4 + 1: return ssse3_to_greyscale(src, dst, count, 4, img_luma_weights());
+        case 3 * 4 + 1: return ssse3_to_greyscale(src, dst, count, 3, img_luma_weights());
+        case 1 * 4 + 3: return ssse3_greyscale_to_rgb(src, dst, count);
+        case 1 * 4 + 4: return ssse3_greyscale_to_rgba(src, dst, count);
+    }
+    return 0;
+}
+
+static size_t simd_black_and_white(uint8_t* row, const size_t count, const unsigned int channels)
+{
+    if (channels < 3 || !img_simd_ssse3()) return 0;
+    return ssse3_black_and_white(row, count, channels, img_luma_weights());
+}
+
+static size_t simd_negative(uint8_t* row, const size_t size)
+{
+    return img_simd_ssse3() ? ssse3_negative(row, size) : 0;
+}
+
+static size_t simd_reduce(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, const size_t size, const unsigned int channels)
+{
+    if (channels == 3 || !img_simd_ssse3()) return 0;
+    return ssse3_reduce(r0, r1, dst, size, channels);
+}
+
+/* forward returns the first 48 byte block in [lo, hi) with a set masked byte or
+ * hi, reverse returns the last one plus one or lo */
+IMG_TARGET_SSSE3
+static size_t ssse3_find(const uint8_t* row, size_t lo, size_t hi, const uint8_t* pattern, const uint8_t* mask, const int reverse)
+{
+    const __m128i p0 = _mm_loadu_si128((const __m128i*)pattern), m0 = _mm_loadu_si128((const __m128i*)mask);
+    const __m128i p1 = _mm_loadu_si128((const __m128i*)(pattern + 16)), m1 = _mm_loadu_si128((const __m128i*)(mask + 16));
+    const __m128i p2 = _mm_loadu_si128((const __m128i*)(pattern + 32)), m2 = _mm_loadu_si128((const __m128i*)(mask + 32));
+    const __m128i zero = _mm_setzero_si128();
+    while (lo < hi) {
+        const uint8_t* b = row + (reverse ? hi - 1 : lo) * 48;
+        const __m128i x0 = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)b), p0), m0);
+        const __m128i x1 = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(b + 16)), p1), m1);
+        const __m128i x2 = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(b + 32)), p2), m2);
+        const __m128i x = _mm_or_si128(_mm_or_si128(x0, x1), x2);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF) return reverse ? hi : lo;
+        if (reverse) hi--;
+        else lo++;
+    }
+    return lo;
+}
+
+static size_t simd_find(const uint8_t* row, const size_t lo, const size_t hi, const uint8_t* pattern, const uint8_t* mask, const int reverse)
+{
+    if (!img_simd_ssse3()) return reverse ? hi : lo;
+    return ssse3_find(row, lo, hi, pattern, mask, reverse);
+}
+
+/* blocks of 1024 pixels, alpha is and-ed together and red is spread over
+ * green and blue to or the differences */
+IMG_TARGET_SSSE3
+static size_t ssse3_scan(const uint8_t* px, const size_t count, unsigned int* flags)
+{
+    const __m128i red = _mm_setr_epi8(0, 0, 0, 3, 4, 4, 4, 7, 8, 8, 8, 11, 12, 12, 12, 15);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    while (*flags && i + 4 <= count) {
+        const size_t end = count - i < 1024 ? i + (count - i) / 4 * 4 : i + 1024;
+        __m128i all = _mm_set1_epi8(-1), diff = _mm_setzero_si128();
+        for (; i < end; i += 4) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(px + i * 4));
+            all = _mm_and_si128(all, v);
+            diff = _mm_or_si128(diff, _mm_xor_si128(v, _mm_shuffle_epi8(v, red)));
+        }
+        const __m128i zero = _mm_setzero_si128();
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_andnot_si128(all, alpha), zero)) != 0xFFFF) *flags &= ~(unsigned int)IMG_SCAN_OPAQUE;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF) *flags &= ~(unsigned int)IMG_SCAN_GREY;
+    }
+    return i;
+}
+
+static size_t simd_scan(const uint8_t* px, const size_t count, unsigned int* flags)
 {
-    uint8_t* ret = (uint8_t*)malloc(width * height * 3);
-    for (unsigned int y = 0; y < height; y++) {
-        for (unsigned int x = 0; x < width; x++) {
-            ret[(width * y + x) * 3 + 0] = buffer[(width * y + x) * 4 + 0];
-            ret[(width * y + x) * 3 + 1] = buffer[(width * y + x) * 4 + 1];
-            ret[(width * y + x) * 3 + 2] = buffer[(width * y + x) * 4 + 2];
+    if (!img_simd_ssse3()) return 0;
+    return ssse3_scan(px, count, flags);
+}
+
+#elif defined(IMG_SIMD_NEON)
+
+static uint8x8_t neon_luma8(const uint8x8_t r, const uint8x8_t g, const uint8x8_t b, const unsigned int* luma)
+{
+    const uint16x8_t r16 = vmovl_u8(r), g16 = vmovl_u8(g), b16 = vmovl_u8(b);
+    uint32x4_t lo = vmull_n_u16(vget_low_u16(r16), (uint16_t)luma[0]);
+    uint32x4_t hi = vmull_n_u16(vget_high_u16(r16), (uint16_t)luma[0]);
+    lo = vmlal_n_u16(lo, vget_low_u16(g16), (uint16_t)luma[1]);
+    hi = vmlal_n_u16(hi, vget_high_u16(g16), (uint16_t)luma[1]);
+    lo = vmlal_n_u16(lo, vget_low_u16(b16), (uint16_t)luma[2]);
+    hi = vmlal_n_u16(hi, vget_high_u16(b16), (uint16_t)luma[2]);
+    return vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, 15), vrshrn_n_u32(hi, 15)));
+}
+
+/* grey level of 16 pixels, averaged or weighted by luma */
+static uint8x16_t neon_grey16(const uint8x16_t r, const uint8x16_t g, const uint8x16_t b, const unsigned int* luma)
+{
+    if (luma) {
+        const uint8x8_t lo = neon_luma8(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b), luma);
+        const uint8x8_t hi = neon_luma8(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b), luma);
+        return vcombine_u8(lo, hi);
+    }
+    /* doubling high multiply by 21846 / 2 is the same exact division by 3 */
+    const uint16x8_t lo = vaddw_u8(vaddl_u8(vget_low_u8(r), vget_low_u8(g)), vget_low_u8(b));
+    const uint16x8_t hi = vaddw_u8(vaddl_u8(vget_high_u8(r), vget_high_u8(g)), vget_high_u8(b));
+    const int16x8_t dlo = vqdmulhq_n_s16(vreinterpretq_s16_u16(lo), 10923);
+    const int16x8_t dhi = vqdmulhq_n_s16(vreinterpretq_s16_u16(hi), 10923);
+    return vcombine_u8(vqmovun_s16(dlo), vqmovun_s16(dhi));
+}
+
+static size_t simd_convert(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count, const unsigned int sc, const unsigned int dc)
+{
+    size_t i = 0;
+    switch (sc * 4 + dc) {
+        case 3 * 4 + 4:
+            for (; i + 16 <= count; i += 16, src += 48, dst += 64) {
+                const uint8x16x3_t in = vld3q_u8(src);
+                const uint8x16x4_t out = {{in.val[0], in.val[1], in.val[2], vdupq_n_u8(255)}};
+                vst4q_u8(dst, out);
+            }
+            break;
+        case 4 * 4 + 3:
+            for (; i + 16 <= count; i += 16, src += 64, dst += 48) {
+                const uint8x16x4_t in = vld4q_u8(src);
+                const uint8x16x3_t out = {{in.val[0], in.val[1], in.val[2]}};
+                vst3q_u8(dst, out);
+            }
+            break;
+        case 4 * 4 + 1:
+            for (; i + 16 <= count; i += 16, src += 64, dst += 16) {
+                const uint8x16x4_t in = vld4q_u8(src);
+                vst1q_u8(dst, neon_grey16(in.val[0], in.val[1], in.val[2], img_luma_weights()));
+            }
+            break;
+        case 3 * 4 + 1:
+            for (; i + 16 <= count; i += 16, src += 48, dst += 16) {
+                const uint8x16x3_t in = vld3q_u8(src);
+                vst1q_u8(dst, neon_grey16(in.val[0], in.val[1], in.val[2], img_luma_weights()));
+            }
+            break;
+        case 1 * 4 + 3:
+            for (; i + 16 <= count; i += 16, src += 16, dst += 48) {
+                const uint8x16_t g = vld1q_u8(src);
+                const uint8x16x3_t out = {{g, g, g}};
+                vst3q_u8(dst, out);
+            }
+            break;
+        case 1 * 4 + 4:
+            for (; i + 16 <= count; i += 16, src += 16, dst += 64) {
+                const uint8x16_t g = vld1q_u8(src);
+                const uint8x16x4_t out = {{g, g, g, vdupq_n_u8(255)}};
+                vst4q_u8(dst, out);
+            }
+            break;
+    }
+    return i;
+}
+
+/* B&W without luma weights keeps averaging every channel, alpha included */
+static size_t simd_black_and_white(uint8_t* row, const size_t count, const unsigned int channels)
+{
+    const unsigned int* luma = img_luma_weights();
+    size_t i = 0;
+    if (channels == 3) {
+        for (; i + 16 <= count; i += 16, row += 48) {
+            const uint8x16x3_t in = vld3q_u8(row);
+            const uint8x16_t g = neon_grey16(in.val[0], in.val[1], in.val[2], luma);
+            const uint8x16x3_t out = {{g, g, g}};
+            vst3q_u8(row, out);
         }
+    } else if (channels == 4) {
+        for (; i + 16 <= count; i += 16, row += 64) {
+            const uint8x16x4_t in = vld4q_u8(row);
+            uint8x16_t g;
+            if (luma) g = neon_grey16(in.val[0], in.val[1], in.val[2], luma);
+            else {
+                const uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(in.val[0]), vget_low_u8(in.val[1])),
+                        vaddl_u8(vget_low_u8(in.val[2]), vget_low_u8(in.val[3])));
+                const uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(in.val[0]), vget_high_u8(in.val[1])),
+                        vaddl_u8(vget_high_u8(in.val[2]), vget_high_u8(in.val[3])));
+                g = vcombine_u8(vshrn_n_u16(lo, 2), vshrn_n_u16(hi, 2));
+            }
+            const uint8x16x4_t out = {{g, g, g, luma ? in.val[3] : g}};
+            vst4q_u8(row, out);
+        }
+    }
+    return i;
+}
+
+static size_t simd_negative(uint8_t* row, const size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(row + i, vmvnq_u8(vld1q_u8(row + i)));
     }
+    return i;
+}
+
+/* sums the even and odd pixels of two rows, 16 output bytes */
+static uint8x16_t neon_reduce16(const uint8x16_t e0, const uint8x16_t o0, const uint8x16_t e1, const uint8x16_t o1)
+{
+    const uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(e0), vget_low_u8(o0)), vaddl_u8(vget_low_u8(e1), vget_low_u8(o1)));
+    const uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(e0), vget_high_u8(o0)), vaddl_u8(vget_high_u8(e1), vget_high_u8(o1)));
+    return vcombine_u8(vshrn_n_u16(lo, 2), vshrn_n_u16(hi, 2));
+}
+
+static size_t simd_reduce(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, const size_t size, const unsigned int channels)
+{
+    size_t i = 0;
+    if (channels == 3) return 0;
+    for (; i + 16 <= size; i += 16, r0 += 32, r1 += 32) {
+        uint8x16_t e0, o0, e1, o1;
+        if (channels == 4) {
+            const uint32x4x2_t a = vld2q_u32((const uint32_t*)r0), b = vld2q_u32((const uint32_t*)r1);
+            e0 = vreinterpretq_u8_u32(a.val[0]), o0 = vreinterpretq_u8_u32(a.val[1]);
+            e1 = vreinterpretq_u8_u32(b.val[0]), o1 = vreinterpretq_u8_u32(b.val[1]);
+        } else if (channels == 2) {
+            const uint16x8x2_t a = vld2q_u16((const uint16_t*)r0), b = vld2q_u16((const uint16_t*)r1);
+            e0 = vreinterpretq_u8_u16(a.val[0]), o0 = vreinterpretq_u8_u16(a.val[1]);
+            e1 = vreinterpretq_u8_u16(b.val[0]), o1 = vreinterpretq_u8_u16(b.val[1]);
+        } else {
+            const uint8x16x2_t a = vld2q_u8(r0), b = vld2q_u8(r1);
+            e0 = a.val[0], o0 = a.val[1], e1 = b.val[0], o1 = b.val[1];
+        }
+        vst1q_u8(dst + i, neon_reduce16(e0, o0, e1, o1));
+    }
+    return i;
+}
+
+static size_t simd_find(const uint8_t* row, size_t lo, size_t hi, const uint8_t* pattern, const uint8_t* mask, const int reverse)
+{
+    const uint8x16_t p0 = vld1q_u8(pattern), p1 = vld1q_u8(pattern + 16), p2 = vld1q_u8(pattern + 32);
+    const uint8x16_t m0 = vld1q_u8(mask), m1 = vld1q_u8(mask + 16), m2 = vld1q_u8(mask + 32);
+    while (lo < hi) {
+        const uint8_t* b = row + (reverse ? hi - 1 : lo) * 48;
+        const uint8x16_t x0 = vandq_u8(veorq_u8(vld1q_u8(b), p0), m0);
+        const uint8x16_t x1 = vandq_u8(veorq_u8(vld1q_u8(b + 16), p1), m1);
+        const uint8x16_t x2 = vandq_u8(veorq_u8(vld1q_u8(b + 32), p2), m2);
+        const uint64x2_t x = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(x0, x1), x2));
+        if (vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) return reverse ? hi : lo;
+        if (reverse) hi--;
+        else lo++;
+    }
+    return lo;
+}
+
+static size_t simd_scan(const uint8_t* px, const size_t count, unsigned int* flags)
+{
+    size_t i = 0;
+    while (*flags && i + 16 <= count) {
+        const size_t end = count - i < 1024 ? i + (count - i) / 16 * 16 : i + 1024;
+        uint8x16_t all = vdupq_n_u8(255), diff = vdupq_n_u8(0);
+        for (; i < end; i += 16) {
+            const uint8x16x4_t v = vld4q_u8(px + i * 4);
+            all = vandq_u8(all, v.val[3]);
+            diff = vorrq_u8(diff, vorrq_u8(veorq_u8(v.val[0], v.val[1]), veorq_u8(v.val[0], v.val[2])));
+        }
+        const uint64x2_t a = vreinterpretq_u64_u8(vmvnq_u8(all)), d = vreinterpretq_u64_u8(diff);
+        if (vgetq_lane_u64(a, 0) | vgetq_lane_u64(a, 1)) *flags &= ~(unsigned int)IMG_SCAN_OPAQUE;
+        if (vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)) *flags &= ~(unsigned int)IMG_SCAN_GREY;
+    }
+    return i;
+}
+
+#else
+
+static size_t simd_convert(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count, const unsigned int sc, const unsigned int dc)
+{
+    (void)src, (void)dst, (void)count, (void)sc, (void)dc;
+    return 0;
+}
+
+static size_t simd_black_and_white(uint8_t* row, const size_t count, const unsigned int channels)
+{
+    (void)row, (void)count, (void)channels;
+    return 0;
+}
+
+static size_t simd_negative(uint8_t* row, const size_t size)
+{
+    (void)row, (void)size;
+    return 0;
+}
+
+static size_t simd_reduce(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, const size_t size, const unsigned int channels)
+{
+    (void)r0, (void)r1, (void)dst, (void)size, (void)channels;
+    return 0;
+}
+
+static size_t simd_find(const uint8_t* row, const size_t lo, const size_t hi, const uint8_t* pattern, const uint8_t* mask, const int reverse)
+{
+    (void)row, (void)pattern, (void)mask;
+    return reverse ? hi : lo;
+}
+
+static size_t simd_scan(const uint8_t* px, const size_t count, unsigned int* flags)
+{
+    (void)px, (void)count, (void)flags;
+    return 0;
+}
+
+#endif
+
+static inline uint8_t px_grey(const uint8_t* px, const unsigned int* luma)
+{
+    if (!luma) return (uint8_t)img_div3((unsigned int)px[0] + px[1] + px[2]);
+    return (uint8_t)((luma[0] * px[0] + luma[1] * px[1] + luma[2] * px[2] + 16384) >> 15);
+}
+
+static void scalar_convert(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count, const unsigned int sc, const unsigned int dc)
+{
+    const unsigned int* luma = img_luma_weights();
+    const int colour = sc >= 3, alpha = sc == 2 || sc == 4;
+    for (size_t i = 0; i < count; i++, src += sc, dst += dc) {
+        const uint8_t grey = colour ? px_grey(src, luma) : src[0];
+        if (dc >= 3) {
+            dst[0] = colour ? src[0] : grey;
+            dst[1] = colour ? src[1] : grey;
+            dst[2] = colour ? src[2] : grey;
+        } else dst[0] = grey;
+        if (dc == 2 || dc == 4) dst[dc - 1] = alpha ? src[sc - 1] : 255;
+    }
+}
+
+void img_convert_row(const uint8_t* restrict src, uint8_t* restrict dst, const size_t count, const unsigned int src_channels, const unsigned int dst_channels)
+{
+    const size_t done = simd_convert(src, dst, count, src_channels, dst_channels);
+    scalar_convert(src + done * src_channels, dst + done * dst_channels, count - done, src_channels, dst_channels);
+}
+
+void img_black_and_white_row(uint8_t* row, const size_t count, const unsigned int channels)
+{
+    const unsigned int* luma = channels >= 3 ? img_luma_weights() : NULL;
+    const size_t done = simd_black_and_white(row, count, channels);
+    row += done * channels;
+    for (size_t i = done; i < count; i++, row += channels) {
+        if (luma) {
+            row[0] = row[1] = row[2] = px_grey(row, luma);
+            continue;
+        }
+        unsigned int m = 0;
+        for (unsigned int j = 0; j < channels; j++) {
+            m += row[j];
+        }
+        memset(row, (int)(m / channels), channels);
+    }
+}
+
+void img_reduce_row(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, const size_t count, const unsigned int channels)
+{
+    const size_t size = count * channels;
+    for (size_t i = simd_reduce(r0, r1, dst, size, channels); i < size; i++) {
+        const size_t x = i / channels * 2 * channels + i % channels;
+        dst[i] = (uint8_t)(((unsigned int)r0[x] + r0[x + channels] + r1[x] + r1[x + channels]) >> 2);
+    }
+}
+
+#define img_found(row, i, pattern, mask) (((row)[i] ^ (pattern)[(i) % 48]) & (mask)[(i) % 48])
+
+size_t img_find_row(const uint8_t* row, const size_t begin, const size_t end, const uint8_t* pattern, const uint8_t* mask)
+{
+    size_t i = begin;
+    for (; i < end && i % 48; i++) {
+        if (img_found(row, i, pattern, mask)) return i;
+    }
+    if (i < end) i = simd_find(row, i / 48, end / 48, pattern, mask, 0) * 48;
+    for (; i < end; i++) {
+        if (img_found(row, i, pattern, mask)) return i;
+    }
+    return end;
+}
+
+size_t img_find_row_last(const uint8_t* row, const size_t begin, const size_t end, const uint8_t* pattern, const uint8_t* mask)
+{
+    size_t i = end;
+    for (; i > begin && i % 48; i--) {
+        if (img_found(row, i - 1, pattern, mask)) return i;
+    }
+    if (i > begin) i = simd_find(row, (begin + 47) / 48, i / 48, pattern, mask, 1) * 48;
+    for (; i > begin; i--) {
+        if (img_found(row, i - 1, pattern, mask)) return i;
+    }
+    return begin;
+}
+
+unsigned int img_scan_rgba(const uint8_t* px, const size_t count)
+{
+    unsigned int flags = IMG_SCAN_OPAQUE | IMG_SCAN_GREY;
+    for (size_t i = simd_scan(px, count, &flags); i < count && flags; i++) {
+        const uint8_t* p = px + i * 4;
+        if (p[3] != 255) flags &= ~(unsigned int)IMG_SCAN_OPAQUE;
+        if (p[0] != p[1] || p[0] != p[2]) flags &= ~(unsigned int)IMG_SCAN_GREY;
+    }
+    return flags;
+}
+
+void img_negative_row(uint8_t* row, const size_t size)
+{
+    for (size_t i = simd_negative(row, size); i < size; i++) {
+        row[i] = 255 - row[i];
+    }
+}
+
+static uint8_t* img_convert(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height, const unsigned int src, const unsigned int dst)
+{
+    const size_t count = (size_t)width * height;
+    uint8_t* ret = (uint8_t*)malloc(count * dst);
+    if (!ret) {
+        fprintf(stderr, "imgtool could not allocate memory for image conversion\n");
+        return NULL;
+    }
+    img_convert_row(buffer, ret, count, src, dst);
     return ret;
 }
 
+uint8_t* rgba_to_greyscale(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+{
+    return img_convert(buffer, width, height, IMG_RGBA, IMG_G);
+}
+
+uint8_t* rgb_to_greyscale(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+{
+    return img_convert(buffer, width, height, IMG_RGB, IMG_G);
+}
+
+uint8_t* rgb_to_rgba(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+{
+    return img_convert(buffer, width, height, IMG_RGB, IMG_RGBA);
+}
+
+uint8_t* rgba_to_rgb(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+{
+    return img_convert(buffer, width, height, IMG_RGBA, IMG_RGB);
+}
+
+uint8_t* greyscale_to_rgb(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+{
+    return img_convert(buffer, width, height, IMG_G, IMG_RGB);
+}
+
+uint8_t* greyscale_to_rgba(const uint8_t* restrict buffer, const unsigned int width, const unsigned int height)
+{
+    return img_convert(buffer, width, height, IMG_G, IMG_RGBA);
+}
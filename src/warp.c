@@ -0,0 +1,399 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "thread.h"
+#include "simd.h"
+
+/*********************
+ -> Geometric warps <-
+ ********************/
+
+#define WARP_ONE 4294967296.0
+#define WARP_EPS 1e-3
+
+/* sample coordinates are 32.32 fixed point with pixel centers on integers,
+ * interpolation weights are 7 bit and bicubic rows are summed to 12 bits */
+typedef struct {
+    const bmp_t* src;
+    bmp_t* dst;
+    double m[9];
+    int16_t cubic[128][4];
+    unsigned int taps;
+    img_border_enum border;
+    int affine;
+} warp_job_t;
+
+static int warp_int(const int64_t u)
+{
+    return (int)((u + ((int64_t)1 << 40)) >> 32) - 256;
+}
+
+static unsigned int warp_frac(const int64_t u)
+{
+    return (unsigned int)(((uint64_t)u >> 25) & 127);
+}
+
+/* rounds to fixed point, anything further than the widest kernel outside the
+ * source samples the same as the clamped value */
+static int64_t warp_fixed(double s, const unsigned int size)
+{
+    if (!(s > -8.0)) s = -8.0;
+    if (s > size + 8.0) s = size + 8.0;
+    return (int64_t)floor(s * WARP_ONE + 0.5);
+}
+
+static void warp_weights(const warp_job_t* job, const int64_t u, int* w)
+{
+    const unsigned int f = warp_frac(u);
+    if (job->taps == 1) w[0] = 128;
+    else if (job->taps == 2) w[0] = 128 - (int)f, w[1] = (int)f;
+    else for (int i = 0; i < 4; i++) w[i] = job->cubic[f][i];
+}
+
+static double cubic(double x)
+{
+    x = fabs(x);
+    if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+    if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    return 0.0;
+}
+
+/* Catmull-Rom taps at -1, 0, 1 and 2 for every 7 bit fraction, summing to 128 */
+static void warp_cubic_table(int16_t table[128][4])
+{
+    for (int f = 0; f < 128; f++) {
+        const double t = f / 128.0;
+        int sum = 0, peak = 0;
+        for (int i = 0; i < 4; i++) {
+            table[f][i] = (int16_t)lround(cubic(t + 1 - i) * 128.0);
+            sum += table[f][i];
+            if (table[f][i] > table[f][peak]) peak = i;
+        }
+        table[f][peak] += (int16_t)(128 - sum);
+    }
+}
+
+/* any position and channel count, taps outside the source are dropped or clamped */
+static void warp_pixel(const warp_job_t* job, const int64_t u, const int64_t v, uint8_t* out)
+{
+    const bmp_t* src = job->src;
+    const int n = (int)job->taps, o = n == 4;
+    const int w = (int)src->width, h = (int)src->height;
+    const unsigned int channels = src->channels;
+    const int ix = warp_int(u) - o, iy = warp_int(v) - o;
+    int wx[4], wy[4], sum[4] = {0};
+    warp_weights(job, u, wx);
+    warp_weights(job, v, wy);
+
+    for (int j = 0; j < n; j++) {
+        int y = iy + j;
+        if (y < 0 || y >= h) {
+            if (job->border == IMG_BORDER_ZERO) continue;
+            y = y < 0 ? 0 : h - 1;
+        }
+        int row[4] = {0};
+        for (int i = 0; i < n; i++) {
+            int x = ix + i;
+            if (x < 0 || x >= w) {
+                if (job->border == IMG_BORDER_ZERO) continue;
+                x = x < 0 ? 0 : w - 1;
+            }
+            const uint8_t* p = row_at(src, y) + (size_t)x * channels;
+            for (unsigned int c = 0; c < channels; c++) {
+                row[c] += p[c] * wx[i];
+            }
+        }
+        for (unsigned int c = 0; c < channels; c++) {
+            sum[c] += (n == 4 ? row[c] >> 2 : row[c]) * wy[j];
+        }
+    }
+
+    const int shift = n == 4 ? 12 : 14;
+    for (unsigned int c = 0; c < channels; c++) {
+        const int s = (sum[c] + (1 << (shift - 1))) >> shift;
+        out[c] = (uint8_t)(s < 0 ? 0 : s > 255 ? 255 : s);
+    }
+}
+
+/* every tap is inside the source, so rows are read without clamping */
+static void warp_span_scalar(const warp_job_t* job, const int64_t* uv, const unsigned int count, uint8_t* out)
+{
+    const bmp_t* src = job->src;
+    const unsigned int channels = src->channels, n = job->taps, o = n == 4;
+    for (unsigned int i = 0; i < count; i++, uv += 2, out += channels) {
+        int wx[4], wy[4];
+        warp_weights(job, uv[0], wx);
+        warp_weights(job, uv[1], wy);
+        const uint8_t* p = row_at(src, warp_int(uv[1]) - o) + (size_t)(warp_int(uv[0]) - o) * channels;
+        if (n == 2) {
+            const uint8_t* q = p + src->stride;
+            for (unsigned int c = 0; c < channels; c++) {
+                const int top = p[c] * wx[0] + p[c + channels] * wx[1];
+                const int bottom = q[c] * wx[0] + q[c + channels] * wx[1];
+                out[c] = (uint8_t)((top * wy[0] + bottom * wy[1] + 8192) >> 14);
+            }
+            continue;
+        }
+        for (unsigned int c = 0; c < channels; c++) {
+            int sum = 0;
+            const uint8_t* r = p + c;
+            for (unsigned int j = 0; j < n; j++, r += src->stride) {
+                int row = 0;
+                for (unsigned int k = 0; k < n; k++) {
+                    row += r[k * channels] * wx[k];
+                }
+                sum += (n == 4 ? row >> 2 : row) * wy[j];
+            }
+            const int v = n == 4 ? (sum + 2048) >> 12 : (sum + 8192) >> 14;
+            out[c] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+        }
+    }
+}
+
+#if defined(IMG_SIMD_SSSE3)
+
+/* the two taps of every channel are paired so madd weighs them at once */
+IMG_TARGET_SSSE3
+static void ssse3_warp_span(const warp_job_t* job, const int64_t* uv, const unsigned int count, uint8_t* out)
+{
+    const bmp_t* src = job->src;
+    const __m128i pairs = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    const __m128i zero = _mm_setzero_si128();
+    for (unsigned int i = 0; i < count; i++, uv += 2, out += 4) {
+        int wx[4], wy[4];
+        warp_weights(job, uv[0], wx);
+        warp_weights(job, uv[1], wy);
+        const int x = warp_int(uv[0]), y = warp_int(uv[1]);
+        __m128i acc;
+        if (job->taps == 2) {
+            const uint8_t* r0 = row_at(src, y) + (size_t)x * 4;
+            const __m128i a = _mm_unpacklo_epi8(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)r0), pairs), zero);
+            const __m128i b = _mm_unpacklo_epi8(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)(r0 + src->stride)), pairs), zero);
+            acc = _mm_add_epi32(_mm_madd_epi16(a, _mm_set1_epi32((wx[1] * wy[0]) << 16 | (wx[0] * wy[0]))),
+                                _mm_madd_epi16(b, _mm_set1_epi32((wx[1] * wy[1]) << 16 | (wx[0] * wy[1]))));
+            acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(8192)), 14);
+        } else {
+            const __m128i w01 = _mm_set1_epi32((int)((uint32_t)(uint16_t)wx[1] << 16 | (uint16_t)wx[0]));
+            const __m128i w23 = _mm_set1_epi32((int)((uint32_t)(uint16_t)wx[3] << 16 | (uint16_t)wx[2]));
+            __m128i rows[4];
+            for (int j = 0; j < 4; j++) {
+                const uint8_t* r = row_at(src, y - 1 + j) + (size_t)(x - 1) * 4;
+                const __m128i p = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)r), pairs);
+                const __m128i s = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), w01), _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), w23));
+                rows[j] = _mm_srai_epi32(s, 2);
+            }
+            const __m128i a = _mm_unpacklo_epi16(_mm_packs_epi32(rows[0], rows[0]), _mm_packs_epi32(rows[1], rows[1]));
+            const __m128i b = _mm_unpacklo_epi16(_mm_packs_epi32(rows[2], rows[2]), _mm_packs_epi32(rows[3], rows[3]));
+            acc = _mm_add_epi32(_mm_madd_epi16(a, _mm_set1_epi32((int)((uint32_t)(uint16_t)wy[1] << 16 | (uint16_t)wy[0]))),
+                                _mm_madd_epi16(b, _mm_set1_epi32((int)((uint32_t)(uint16_t)wy[3] << 16 | (uint16_t)wy[2]))));
+            acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(2048)), 12);
+        }
+        const __m128i px = _mm_packus_epi16(_mm_packs_epi32(acc, acc), zero);
+        const int value = _mm_cvtsi128_si32(px);
+        memcpy(out, &value, 4);
+    }
+}
+
+static unsigned int simd_warp_span(const warp_job_t* job, const int64_t* uv, const unsigned int count, uint8_t* out)
+{
+    if (job->src->channels != 4 || job->taps == 1 || !img_simd_ssse3()) return 0;
+    ssse3_warp_span(job, uv, count, out);
+    return count;
+}
+
+#elif defined(IMG_SIMD_NEON)
+
+static unsigned int simd_warp_span(const warp_job_t* job, const int64_t* uv, const unsigned int count, uint8_t* out)
+{
+    const bmp_t* src = job->src;
+    if (src->channels != 4 || job->taps == 1) return 0;
+    for (unsigned int i = 0; i < count; i++, uv += 2, out += 4) {
+        int wx[4], wy[4];
+        warp_weights(job, uv[0], wx);
+        warp_weights(job, uv[1], wy);
+        const int x = warp_int(uv[0]), y = warp_int(uv[1]);
+        int16x4_t px;
+        if (job->taps == 2) {
+            int32x4_t acc = vdupq_n_s32(0);
+            for (int j = 0; j < 2; j++) {
+                const int16x8_t p = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row_at(src, y + j) + (size_t)x * 4)));
+                acc = vmlal_n_s16(acc, vget_low_s16(p), (int16_t)(wx[0] * wy[j]));
+                acc = vmlal_n_s16(acc, vget_high_s16(p), (int16_t)(wx[1] * wy[j]));
+            }
+            px = vrshrn_n_s32(acc, 14);
+        } else {
+            int32x4_t acc = vdupq_n_s32(0);
+            for (int j = 0; j < 4; j++) {
+                const uint8_t* r = row_at(src, y - 1 + j) + (size_t)(x - 1) * 4;
+                const int16x8_t p01 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(r)));
+                const int16x8_t p23 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(r + 8)));
+                int32x4_t row = vmull_n_s16(vget_low_s16(p01), (int16_t)wx[0]);
+                row = vmlal_n_s16(row, vget_high_s16(p01), (int16_t)wx[1]);
+                row = vmlal_n_s16(row, vget_low_s16(p23), (int16_t)wx[2]);
+                row = vmlal_n_s16(row, vget_high_s16(p23), (int16_t)wx[3]);
+                acc = vmlaq_n_s32(acc, vshrq_n_s32(row, 2), wy[j]);
+            }
+            px = vqrshrn_n_s32(acc, 12);
+        }
+        vst1_lane_u32((uint32_t*)(void*)out, vreinterpret_u32_u8(vqmovun_s16(vcombine_s16(px, px))), 0);
+    }
+    return count;
+}
+
+#else
+
+static unsigned int simd_warp_span(const warp_job_t* job, const int64_t* uv, const unsigned int count, uint8_t* out)
+{
+    (void)job, (void)uv, (void)count, (void)out;
+    return 0;
+}
+
+#endif
+
+/* narrows [lo, hi] to the t where a + b * t >= 0 */
+static void warp_clip(const double a, const double b, double* lo, double* hi)
+{
+    if (b > 0.0) {
+        if (-a / b > *lo) *lo = -a / b;
+    } else if (b < 0.0) {
+        if (-a / b < *hi) *hi = -a / b;
+    } else if (a < 0.0) *hi = *lo - 1.0;
+}
+
+/* the x span of a dst row where every tap lands inside the source */
+static void warp_span(const warp_job_t* job, const double* p, const double* d, const double c, unsigned int* xa, unsigned int* xb)
+{
+    const unsigned int n = job->taps, o = n == 4;
+    const double size[2] = {job->src->width, job->src->height};
+    double lo = 0.0, hi = job->dst->width - 1.0;
+    warp_clip(p[2] - 1e-9, d[2], &lo, &hi);
+    for (int k = 0; k < 2; k++) {
+        const double first = o + WARP_EPS + c, last = size[k] - n + o + 1 - WARP_EPS + c;
+        warp_clip(p[k] - first * p[2], d[k] - first * d[2], &lo, &hi);
+        warp_clip(last * p[2] - p[k], last * d[2] - d[k], &lo, &hi);
+    }
+    *xa = *xb = 0;
+    if (hi < lo) return;
+    *xa = (unsigned int)ceil(lo);
+    *xb = (unsigned int)floor(hi) + 1;
+}
+
+static void warp_rows(void* arg, const unsigned int begin, const unsigned int end)
+{
+    const warp_job_t* job = arg;
+    const bmp_t* src = job->src;
+    bmp_t* dst = job->dst;
+    const unsigned int width = dst->width, channels = dst->channels;
+    int64_t* uv = malloc(2 * (size_t)width * sizeof(int64_t));
+    if (!uv) {
+        fprintf(stderr, "imgtool could not allocate memory for warping\n");
+        return;
+    }
+
+    /* nearest sampling rounds instead of flooring */
+    const double c = job->taps == 1 ? 0.0 : 0.5;
+    const double* m = job->m;
+    const double d[3] = {m[0], m[3], m[6]};
+    for (unsigned int y = begin; y < end; y++) {
+        const double p[3] = {
+            m[0] * 0.5 + m[1] * (y + 0.5) + m[2],
+            m[3] * 0.5 + m[4] * (y + 0.5) + m[5],
+            m[6] * 0.5 + m[7] * (y + 0.5) + m[8]
+        };
+        unsigned int xa, xb;
+        warp_span(job, p, d, c, &xa, &xb);
+
+        /* steps the homogeneous position, affine spans step in fixed point */
+        const int fixed = job->affine && xa < xb;
+        double u = p[0], v = p[1], w = p[2];
+        for (unsigned int x = 0; x < width; x++, u += d[0], v += d[1], w += d[2]) {
+            if (fixed && x >= xa && x < xb) continue;
+            if (w > 1e-9) {
+                uv[x * 2] = warp_fixed(u / w - c, src->width);
+                uv[x * 2 + 1] = warp_fixed(v / w - c, src->height);
+            } else uv[x * 2] = uv[x * 2 + 1] = warp_fixed(-8.0, 0);
+        }
+        if (fixed) {
+            const int64_t du = (int64_t)floor(d[0] * WARP_ONE + 0.5), dv = (int64_t)floor(d[1] * WARP_ONE + 0.5);
+            int64_t fu = (int64_t)floor((p[0] + xa * d[0] - c) * WARP_ONE + 0.5);
+            int64_t fv = (int64_t)floor((p[1] + xa * d[1] - c) * WARP_ONE + 0.5);
+            for (unsigned int x = xa; x < xb; x++, fu += du, fv += dv) {
+                uv[x * 2] = fu;
+                uv[x * 2 + 1] = fv;
+            }
+        }
+
+        uint8_t* out = row_at(dst, y);
+        for (unsigned int x = 0; x < xa; x++) {
+            warp_pixel(job, uv[x * 2], uv[x * 2 + 1], out + (size_t)x * channels);
+        }
+        unsigned int x = xa + simd_warp_span(job, uv + (size_t)xa * 2, xb - xa, out + (size_t)xa * channels);
+        if (job->taps == 1) {
+            for (; x < xb; x++) {
+                const uint8_t* p = row_at(src, warp_int(uv[x * 2 + 1])) + (size_t)warp_int(uv[x * 2]) * channels;
+                for (unsigned int c = 0; c < channels; c++) {
+                    out[(size_t)x * channels + c] = p[c];
+                }
+            }
+        } else if (x < xb) {
+            warp_span_scalar(job, uv + (size_t)x * 2, xb - x, out + (size_t)x * channels);
+            x = xb;
+        }
+        for (; x < width; x++) {
+            warp_pixel(job, uv[x * 2], uv[x * 2 + 1], out + (size_t)x * channels);
+        }
+    }
+    free(uv);
+}
+
+/* inverts the forward matrix so every dst pixel finds its source position */
+static int warp_invert(const float* f, double* m)
+{
+    const double a = f[0], b = f[1], c = f[2], d = f[3], e = f[4], g = f[5], h = f[6], i = f[7], k = f[8];
+    const double det = a * (e * k - g * i) - b * (d * k - g * h) + c * (d * i - e * h);
+    if (fabs(det) < 1e-12) return 0;
+    m[0] = (e * k - g * i) / det, m[1] = (c * i - b * k) / det, m[2] = (b * g - c * e) / det;
+    m[3] = (g * h - d * k) / det, m[4] = (a * k - c * h) / det, m[5] = (c * d - a * g) / det;
+    m[6] = (d * i - e * h) / det, m[7] = (b * h - a * i) / det, m[8] = (a * e - b * d) / det;
+    return 1;
+}
+
+void bmp_warp_into(const bmp_t* restrict bitmap, bmp_t* restrict dst, const float* matrix, const img_filter_enum filter, const img_border_enum border)
+{
+    warp_job_t* job = malloc(sizeof(warp_job_t));
+    if (!job) {
+        fprintf(stderr, "imgtool could not allocate memory for warping\n");
+        return;
+    }
+    if (!warp_invert(matrix, job->m)) {
+        fprintf(stderr, "imgtool cannot warp with a singular matrix\n");
+        free(job);
+        return;
+    }
+
+    job->affine = matrix[6] == 0.0F && matrix[7] == 0.0F;
+    if (job->affine) {
+        for (int i = 0; i < 6; i++) {
+            job->m[i] /= job->m[8];
+        }
+        job->m[6] = job->m[7] = 0.0, job->m[8] = 1.0;
+    }
+    job->taps = filter == IMG_FILTER_BOX ? 1 : filter == IMG_FILTER_TRIANGLE ? 2 : 4;
+    job->border = border;
+    if (job->taps == 4) warp_cubic_table(job->cubic);
+
+    bmp_reserve(dst, bitmap->width, bitmap->height, bitmap->channels);
+    job->src = bitmap;
+    job->dst = dst;
+    img_parallel_for(warp_rows, job, dst->height, row_grain(dst->width * dst->channels));
+    free(job);
+}
+
+bmp_t bmp_warp(const bmp_t* restrict bitmap, const float* matrix, const img_filter_enum filter, const img_border_enum border)
+{
+    bmp_t new_bitmap = {0};
+    bmp_warp_into(bitmap, &new_bitmap, matrix, filter, border);
+    return new_bitmap;
+}
@@ -0,0 +1,76 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* inverse orientation pairs around a scaling command must leave exactly the
+ * bytes of the scaling command alone, whatever run it is folded into */
+
+static int run(const char* dir, const char* commands, const char* output)
+{
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "./imgtool %s/geometry.ppm %s -o %s/%s > /dev/null", dir, commands, dir, output);
+    return system(cmd) == 0;
+}
+
+static uint8_t* load(const char* dir, const char* output, unsigned int* width, unsigned int* height)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, output);
+    uint8_t* pixels = ppm_file_load(path, width, height);
+    remove(path);
+    return pixels;
+}
+
+static int compare(const char* dir, const char* scale, const char* pattern)
+{
+    char commands[256];
+    const char* at = strchr(pattern, 'X');
+    snprintf(commands, sizeof(commands), "%.*s%s%s", (int)(at - pattern), pattern, scale, at + 1);
+
+    unsigned int w0 = 0, h0 = 0, w1 = 0, h1 = 0;
+    const int ran = run(dir, scale, "geometry_a.ppm") && run(dir, commands, "geometry_b.ppm");
+    uint8_t* a = load(dir, "geometry_a.ppm", &w0, &h0);
+    uint8_t* b = load(dir, "geometry_b.ppm", &w1, &h1);
+    const int bad = !ran || !a || !b || w0 != w1 || h0 != h1 || memcmp(a, b, (size_t)w0 * h0 * 3);
+    if (bad) fprintf(stderr, "geometry: '%s' differs from '%s'\n", commands, scale);
+    free(a);
+    free(b);
+    return bad;
+}
+
+int main(const int argc, const char** argv)
+{
+    const char* dir = argc > 1 ? argv[1] : ".";
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/geometry.ppm", dir);
+
+    /* odd sizes so -s drops an edge that a flip would move */
+    const unsigned int width = 101, height = 67;
+    uint8_t* data = malloc((size_t)width * height * 3);
+    if (!data) return EXIT_FAILURE;
+    unsigned int seed = 11;
+    for (size_t i = 0; i < (size_t)width * height * 3; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+    ppm_file_write(path, data, width, height);
+    free(data);
+
+    static const char* scales[] = {
+        "-s", "-S", "-R 0.5", "-R 0.37", "-R 1.6", "-Rx 40", "-Ry 33",
+        "-resize 50x30", "-resize 40x0:lanczos3", "-resize 0x90:area"
+    };
+    static const char* patterns[] = {
+        "X -fh -fh", "-fh -fh X", "X -fv -fv", "X -r180 -r180", "-r -r270 X", "X -r270 -r", "-S -s X", "X -S -s"
+    };
+    int bad = 0;
+    for (unsigned int i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+        for (unsigned int j = 0; j < sizeof(patterns) / sizeof(patterns[0]); j++) {
+            bad += compare(dir, scales[i], patterns[j]);
+        }
+    }
+    remove(path);
+    printf("geometry: %s\n", bad ? "FAILED" : "passed");
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
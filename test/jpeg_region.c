@@ -0,0 +1,62 @@
+#include <imgtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* region decodes must match a full decode viewed over the same window,
+ * including windows on and beside iMCU boundaries and scaled decodes */
+
+static int compare(const char* path, const unsigned int x, const unsigned int y, const unsigned int w, const unsigned int h, const unsigned int denom)
+{
+    bmp_t full = {0};
+    full.pixels = jpeg_file_load_scaled(path, &full.width, &full.height, denom);
+    full.channels = 3;
+    full.stride = full.width * 3;
+
+    unsigned int width = w, height = h;
+    uint8_t* region = jpeg_file_load_region_scaled(path, x, y, &width, &height, denom);
+    const bmp_t view = bmp_view(&full, x, y, width, height);
+    int bad = !region || !full.pixels || width != view.width || height != view.height;
+    for (unsigned int i = 0; !bad && i < height; i++) {
+        bad = memcmp(region + (size_t)width * 3 * i, view.pixels + (size_t)view.stride * i, (size_t)width * 3) != 0;
+    }
+    if (bad) fprintf(stderr, "jpeg_region: %ux%u+%u+%u at 1/%u differs from the full decode\n", w, h, x, y, denom);
+    free(region);
+    bmp_free(&full);
+    return bad;
+}
+
+int main(const int argc, const char** argv)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/jpeg_region.jpg", argc > 1 ? argv[1] : ".");
+    const unsigned int width = 1603, height = 1201;
+    uint8_t* data = malloc((size_t)width * height * 3);
+    if (!data) return EXIT_FAILURE;
+
+    /* sharp colour edges make every chroma sample matter */
+    unsigned int seed = 7;
+    for (size_t i = 0; i < (size_t)width * height * 3; i++) {
+        seed = seed * 1103515245 + 12345;
+        const size_t x = i / 3 % width, y = i / 3 / width;
+        data[i] = (uint8_t)(((x / 5 + y / 3) % 2) * 160 + (seed >> 24) % 64 + (i % 3) * 20);
+    }
+    jpeg_file_write(path, data, width, height, 90);
+    free(data);
+
+    static const unsigned int windows[][4] = {
+        {301, 203, 17, 33}, {300, 200, 16, 16}, {64, 64, 100, 100}, {1, 1, 0, 0},
+        {1, 1, 1602, 1200}, {15, 17, 1, 15}, {16, 16, 1584, 1184}, {33, 7, 1570, 0},
+        {1603, 1, 0, 600}, {1, 1201, 800, 0}, {0, 0, 1000, 900}, {0, 0, 0, 0}
+    };
+    int bad = 0;
+    for (unsigned int denom = 1; denom <= 8; denom *= 2) {
+        for (unsigned int i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+            const unsigned int* r = windows[i];
+            bad += compare(path, r[2] / denom, r[3] / denom, r[0] / denom, r[1] / denom, denom);
+        }
+    }
+    remove(path);
+    printf("jpeg_region: %s\n", bad ? "FAILED" : "passed");
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}